@@ -1,6 +1,15 @@
+#include <stdlib.h>
 #include "img_common.h"
 
-const uint32_t web_color[216] = {
+#ifdef IMG_USE_THREAD
+#include <pthread.h>
+#endif
+
+// img_parallel_for 最多创建的线程数
+#define IMG_MAX_THREADS 64
+
+// 216~255不是web颜色，解码为黑色，避免越界
+const uint32_t web_color[256] = {
     0x000000, 0x000033, 0x000066, 0x000099, 0x0000CC, 0x0000FF,
     0x003300, 0x003333, 0x003366, 0x003399, 0x0033CC, 0x0033FF,
     0x006600, 0x006633, 0x006666, 0x006699, 0x0066CC, 0x0066FF,
@@ -38,3 +47,110 @@ const uint32_t web_color[216] = {
     0xFFCC00, 0xFFCC33, 0xFFCC66, 0xFFCC99, 0xFFCCCC, 0xFFCCFF,
     0xFFFF00, 0xFFFF33, 0xFFFF66, 0xFFFF99, 0xFFFFCC, 0xFFFFFF,
 };
+
+#ifdef IMG_USE_X86_SIMD
+// 检测过的指令集，最高位表示已经检测过，各函数每次调用都会读取，只在第一次调用时检测
+#define IMG_CPU_DETECTED 0x80000000u
+static uint32_t cpu_flags = 0;
+#endif
+
+uint32_t img_cpu_flags(void)
+{
+    uint32_t flags = 0;
+#ifdef IMG_USE_X86_SIMD
+    // 多个线程同时第一次调用时各自检测，结果相同，重复写入没有影响
+    flags = __atomic_load_n(&cpu_flags, __ATOMIC_RELAXED);
+    if (flags & IMG_CPU_DETECTED)
+    {
+        return flags & ~IMG_CPU_DETECTED;
+    }
+    flags = 0;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        flags |= IMG_CPU_SSE2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        flags |= IMG_CPU_SSSE3;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        flags |= IMG_CPU_AVX2;
+    }
+    __atomic_store_n(&cpu_flags, flags | IMG_CPU_DETECTED, __ATOMIC_RELAXED);
+#endif
+    return flags;
+}
+
+#ifdef IMG_USE_THREAD
+typedef struct
+{
+    pthread_mutex_t lock;
+    int32_t next; // 下一个未领取的序号
+    int32_t count;
+    img_task_func func;
+    void *arg;
+} img_parallel_ctx;
+
+static void *img_parallel_worker(void *arg)
+{
+    img_parallel_ctx *p = (img_parallel_ctx *)arg;
+    int32_t index = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&p->lock);
+        index = p->next++;
+        pthread_mutex_unlock(&p->lock);
+        if (index >= p->count)
+        {
+            break;
+        }
+        p->func(p->arg, index);
+    }
+    return NULL;
+}
+#endif
+
+void img_parallel_for(int32_t count, int32_t threads, img_task_func func, void *arg)
+{
+    int32_t i = 0;
+#ifdef IMG_USE_THREAD
+    pthread_t tid[IMG_MAX_THREADS];
+    img_parallel_ctx p;
+    int32_t n = 0;
+
+    threads = threads > count ? count : threads;
+    threads = threads > IMG_MAX_THREADS ? IMG_MAX_THREADS : threads;
+    if (threads > 1)
+    {
+        p.next = 0;
+        p.count = count;
+        p.func = func;
+        p.arg = arg;
+        pthread_mutex_init(&p.lock, NULL);
+        // 创建线程失败时由已有的线程完成剩余的任务
+        for (n = 0; n < threads - 1; n++)
+        {
+            if (pthread_create(&tid[n], NULL, img_parallel_worker, &p))
+            {
+                break;
+            }
+        }
+        img_parallel_worker(&p);
+        for (i = 0; i < n; i++)
+        {
+            pthread_join(tid[i], NULL);
+        }
+        pthread_mutex_destroy(&p.lock);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    for (i = 0; i < count; i++)
+    {
+        func(arg, i);
+    }
+}
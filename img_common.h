@@ -3,6 +3,26 @@
 
 #include <stdint.h>
 
+// 编译选项，移植至单片机等平台时可定义以下宏关闭对应功能
+// IMG_NO_MMAP 不使用内存映射方式读取文件
+// IMG_NO_THREAD 不使用多线程（pthread）
+// IMG_NO_SIMD 不使用SIMD指令（目前仅支持x86的SSE2、SSSE3、AVX2，运行时根据CPU选择）
+#if !defined(IMG_NO_MMAP) && (defined(_WIN32) || defined(__unix__) || defined(__APPLE__))
+#define IMG_USE_MMAP
+#endif
+#if !defined(IMG_NO_THREAD) && (defined(_WIN32) || defined(__unix__) || defined(__APPLE__))
+#define IMG_USE_THREAD
+#endif
+#if !defined(IMG_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMG_USE_X86_SIMD
+#define IMG_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// img_cpu_flags 的返回值
+#define IMG_CPU_SSE2  0x01
+#define IMG_CPU_SSSE3 0x02
+#define IMG_CPU_AVX2  0x04
+
 typedef enum {
     IMG_OK,
     IMG_PARAM_NULL_PTR,
@@ -38,6 +58,28 @@ typedef enum {
     FMT_INVALID,
 } fmt_e;
 
-extern const uint32_t web_color[216];
+extern const uint32_t web_color[256];
+
+/**
+ * @brief 获取当前CPU支持的SIMD指令集，用于运行时选择解码、编码函数
+ * @note 只在第一次调用时检测，之后返回保存的结果，可以在每行的处理函数中调用
+ * 
+ * @return uint32_t IMG_CPU_SSE2 等标志的组合，未启用 IMG_USE_X86_SIMD 时为0
+ */
+uint32_t img_cpu_flags(void);
+
+// img_parallel_for 执行的任务，index 为任务序号
+typedef void(*img_task_func)(void *arg, int32_t index);
+
+/**
+ * @brief 使用多个线程执行 func(arg, 0) ... func(arg, count - 1)，各线程依次领取下一个序号，全部完成后返回
+ * @note 调用线程也参与执行，未启用 IMG_USE_THREAD 或 threads 不大于1时按顺序执行
+ * 
+ * @param count 任务数量
+ * @param threads 线程数量，包括调用线程
+ * @param func 任务函数，不同序号可能同时在不同线程中执行
+ * @param arg 传给 func 的参数
+ */
+void img_parallel_for(int32_t count, int32_t threads, img_task_func func, void *arg);
 
 #endif
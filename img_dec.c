@@ -11,112 +11,724 @@
  * 
  */
 
+// 32位系统上也使用64位的文件偏移，需要在包含系统头文件之前定义
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include "img_dec.h"
 
+#define SAFE_FREE(p) do { if (NULL != (p)){ free(p); (p) = NULL; } }while(0)
+
+#ifdef IMG_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef IMG_USE_THREAD
+#include <pthread.h>
+#endif
+
+// 序列文件可能超过2GB，定位时使用64位的接口
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define img_fseek _fseeki64
+#define img_ftell _ftelli64
+#else
+#define img_fseek fseeko
+#define img_ftell ftello
+#endif
+
+#ifdef IMG_USE_MMAP
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// 各输出格式每个像素的字节数
+static const int32_t pix_bytes[] = {3, 3, 4, 4, 1};
+
+// 解码区域，输出的第i行第j列为原图的第 y + i * step 行、第 x + j * step 列
+typedef struct
+{
+    int32_t x;
+    int32_t y;
+    int32_t width; // 输出的宽度
+    int32_t height; // 输出的高度
+    int32_t step; // 采样间隔，1表示不缩小
+} dec_rect;
+
+// 输出像素格式的查找表，解码函数按输出格式直接写出像素，不需要先解码为RGB888再转换一遍
+typedef struct
+{
+    img_pix_e pix;
+    int32_t bytes; // 每个像素的字节数
+    uint8_t bitmap_lsb[256][32]; // 位图查找表，1字节展开为8个像素，第一个点为最低有效位
+    uint8_t bitmap_msb[256][32]; // 第一个点为最高有效位
+    uint8_t web[256][4]; // web颜色表
+} dec_pix;
+
 // 图片解码函数原型，其中h(horizontal)表示横向长度，v(vertical)表示纵向长度
-typedef void(*convert)(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
+// 只解码 rect 指定的区域，按 pix 的格式输出，输出的第i行写到 out + i * stride 处，可以直接写入调用者带行距的缓冲区
+typedef void(*convert)(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+
+#ifdef IMG_USE_THREAD
+// 预读，解码当前图片的同时，后台线程提前读取之后的 num 张图片
+// 使用内存映射时不需要缓存，后台线程只是提前访问映射的内存，让操作系统把数据读入内存
+typedef struct
+{
+    int32_t running; // 预读线程是否在运行
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *buf; // num 个图片缓存组成的环形队列，第i张图片保存在第 i%num 个缓存中
+    int32_t *ret; // 每个缓存的读取结果
+    int32_t start; // 预读窗口的起始图片序号，即正在解码的图片，窗口范围为 [start, start + num)
+    int32_t loaded; // [start, loaded) 范围内的图片已经读取完毕
+    int32_t generation; // 窗口跳转时加1，丢弃跳转前正在读取的数据
+    int32_t stop; // 通知线程退出
+} img_prefetch;
+#endif
+
+// 解码结果缓存，按最近最少使用的顺序淘汰
+typedef struct
+{
+    int32_t img_num; // 缓存的图片序号，-1表示空闲
+    uint32_t last_use; // 最近一次使用的时间，数值越小越早被淘汰
+    uint8_t *data; // 解码后的RGB888数据，首次使用时分配
+} img_cache_entry;
 
 typedef struct
 {
     FILE *fp;
-    int32_t file_size;
+    int64_t file_size;
+    int32_t is_stream; // 输入为管道等不能定位的文件，只能按顺序读取，图片数量未知
+    int64_t stream_pos; // 已经从管道读取的字节数
     int32_t sum_img_num;
     int32_t now_img_num;
+    int32_t read_img_num; // 下一次解码读取的图片序号，img_dec_seek 时设置，每次解码后加1
     int32_t img_size; // 单张图片的大小，包含文件头尾
-    uint8_t *buf; // 保存未解码的图片数据
+    uint8_t *buf; // 保存未解码的图片数据，使用内存映射时不使用
+    const uint8_t *map; // 整个文件的内存映射，为NULL时使用fread读取
+    int32_t prefetch_num; // 预读的图片数量，0表示不预读
+    int64_t cache_size; // 解码结果缓存的内存上限，0表示不缓存
+    img_cache_entry *cache; // 缓存列表，数量为 cache_num
+    int32_t cache_num;
+    uint32_t cache_time; // 每次访问缓存加1，用于记录 last_use
+    int32_t cache_hit;
+    int32_t cache_miss;
+    dec_rect rect; // 解码区域，img_dec_cfg 后为整张图片
+    dec_pix *pix_tab[PIX_INVALID]; // 各输出格式的查找表，首次使用时生成
+#ifdef IMG_USE_THREAD
+    img_prefetch prefetch;
+#endif
     convert func;
     img_dec_param param;
 } _img_dec_ctx;
 
+// 第num张图片在文件中的位置，文件可能超过2GB，需要使用64位计算
+static int64_t img_dec_offset(_img_dec_ctx *ctx, int32_t num)
+{
+    return ctx->param.file_offset + (int64_t)ctx->img_size * num;
+}
+
+// 读取第 num 张图片的原始数据到 buf，管道只能向后读取，中间跳过的数据直接丢弃
+static img_err_code img_dec_read(_img_dec_ctx *ctx, int32_t num, uint8_t *buf)
+{
+    int64_t pos = img_dec_offset(ctx, num);
+    size_t size = 0;
+
+    if (!ctx->is_stream)
+    {
+        img_fseek(ctx->fp, pos, SEEK_SET);
+        if (fread(buf, 1, ctx->img_size, ctx->fp) != (size_t)ctx->img_size)
+        {
+            return IMG_OTHER_ERR;
+        }
+        return IMG_OK;
+    }
+
+    if (pos < ctx->stream_pos)
+    {
+        return IMG_SEEK_ERR;
+    }
+    while (ctx->stream_pos < pos)
+    {
+        size = pos - ctx->stream_pos < ctx->img_size ? (size_t)(pos - ctx->stream_pos) : (size_t)ctx->img_size;
+        size = fread(buf, 1, size, ctx->fp);
+        if (size == 0)
+        {
+            return IMG_FILE_TAIL;
+        }
+        ctx->stream_pos += size;
+    }
+    size = fread(buf, 1, ctx->img_size, ctx->fp);
+    ctx->stream_pos += size;
+    // 数据结束，最后不完整的图片也丢弃
+    if (size != (size_t)ctx->img_size)
+    {
+        return IMG_FILE_TAIL;
+    }
+    return IMG_OK;
+}
+
 // 解码函数
-static void bitmap_rl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_rm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_cl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_cm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_rcl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_rcm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_crl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bitmap_crm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void web_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void rgb565_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bgr565_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void argb1555_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void bgra5551_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
+static void bitmap_rl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_rm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_cl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_cm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_rcl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_rcm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_crl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bitmap_crm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void web_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void rgb565_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bgr565_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void argb1555_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bgra5551_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void rgb565be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bgr565be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void argb1555be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
+static void bgra5551be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix);
 
 // 解码函数列表，必须与 fmt_e 的顺序保持一致
 static const convert convert_list[] = {
     NULL,
-    bitmap_rl_to_rgb888,
-    bitmap_rm_to_rgb888,
-    bitmap_cl_to_rgb888,
-    bitmap_cm_to_rgb888,
-    bitmap_rcl_to_rgb888,
-    bitmap_rcm_to_rgb888,
-    bitmap_crl_to_rgb888,
-    bitmap_crm_to_rgb888,
-    web_to_rgb888,
-    rgb565_to_rgb888,
-    bgr565_to_rgb888,
-    argb1555_to_rgb888,
-    bgra5551_to_rgb888,
+    bitmap_rl_to_pix,
+    bitmap_rm_to_pix,
+    bitmap_cl_to_pix,
+    bitmap_cm_to_pix,
+    bitmap_rcl_to_pix,
+    bitmap_rcm_to_pix,
+    bitmap_crl_to_pix,
+    bitmap_crm_to_pix,
+    web_to_pix,
+    rgb565_to_pix,
+    bgr565_to_pix,
+    argb1555_to_pix,
+    bgra5551_to_pix,
+};
+
+// 大端格式的解码函数列表，16位图像在解码的同时转换字节序，不需要单独转换一遍
+static const convert convert_list_be[] = {
+    NULL,
+    bitmap_rl_to_pix,
+    bitmap_rm_to_pix,
+    bitmap_cl_to_pix,
+    bitmap_cm_to_pix,
+    bitmap_rcl_to_pix,
+    bitmap_rcm_to_pix,
+    bitmap_crl_to_pix,
+    bitmap_crm_to_pix,
+    web_to_pix,
+    rgb565be_to_pix,
+    bgr565be_to_pix,
+    argb1555be_to_pix,
+    bgra5551be_to_pix,
 };
 
+// 16位图像的格式描述，各分量的计算方法为 ((data & mask) * mul) >> 8，结果为8位数据
+// 所有16位格式共用同一套解码函数，方便SIMD实现
+typedef struct
+{
+    uint16_t mask[3]; // r、g、b分量的掩码
+    uint16_t mul[3]; // r、g、b分量的乘数，均为2的幂，相当于移位
+    uint16_t alpha; // 透明位的掩码，为0表示没有透明位，透明的像素解码为白色
+    int32_t is_big_endian;
+} rgb16_desc;
+
+static const rgb16_desc rgb565_desc      = {{0xF800, 0x07E0, 0x001F}, {1, 32, 2048}, 0x0000, 0};
+static const rgb16_desc bgr565_desc      = {{0x001F, 0x07E0, 0xF800}, {2048, 32, 1}, 0x0000, 0};
+static const rgb16_desc argb1555_desc    = {{0x7C00, 0x03E0, 0x001F}, {2, 64, 2048}, 0x8000, 0};
+static const rgb16_desc bgra5551_desc    = {{0x003E, 0x07C0, 0xF800}, {1024, 32, 1}, 0x0001, 0};
+static const rgb16_desc rgb565be_desc    = {{0xF800, 0x07E0, 0x001F}, {1, 32, 2048}, 0x0000, 1};
+static const rgb16_desc bgr565be_desc    = {{0x001F, 0x07E0, 0xF800}, {2048, 32, 1}, 0x0000, 1};
+static const rgb16_desc argb1555be_desc  = {{0x7C00, 0x03E0, 0x001F}, {2, 64, 2048}, 0x8000, 1};
+static const rgb16_desc bgra5551be_desc  = {{0x003E, 0x07C0, 0xF800}, {1024, 32, 1}, 0x0001, 1};
+
+// 按输出格式写出一个像素，灰度的计算方法与编码器相同
+static void pix_put(uint8_t *out, img_pix_e pix, uint8_t r, uint8_t g, uint8_t b)
+{
+    switch (pix)
+    {
+    case PIX_BGR888:
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        break;
+    case PIX_RGBA8888:
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        out[3] = 0xFF;
+        break;
+    case PIX_BGRA8888:
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        out[3] = 0xFF;
+        break;
+    case PIX_GRAY8:
+        out[0] = (r * 76 + g * 150 + b * 29) >> 8;
+        break;
+    default:
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        break;
+    }
+}
+
+// 取得输出格式的查找表，每种格式第一次使用时生成，之后一直保留到关闭解码器
+static const dec_pix *dec_pix_get(_img_dec_ctx *ctx, img_pix_e pix)
+{
+    dec_pix *t = ctx->pix_tab[pix];
+    int32_t n = 0, i = 0;
+    uint8_t c = 0;
+
+    if (t)
+    {
+        return t;
+    }
+    t = (dec_pix *)malloc(sizeof(dec_pix));
+    if (t == NULL)
+    {
+        printf("malloc img pixel table error\n");
+        return NULL;
+    }
+    memset(t, 0, sizeof(dec_pix));
+    t->pix = pix;
+    t->bytes = pix_bytes[pix];
+    for (n = 0; n < 256; n++)
+    {
+        // bit为1时为白色，为0时为黑色
+        for (i = 0; i < 8; i++)
+        {
+            c = ((n >> i) & 1) * 0xFF;
+            pix_put(&t->bitmap_lsb[n][i * t->bytes], pix, c, c, c);
+            c = ((n >> (7 - i)) & 1) * 0xFF;
+            pix_put(&t->bitmap_msb[n][i * t->bytes], pix, c, c, c);
+        }
+        pix_put(t->web[n], pix, web_color[n] >> 16, web_color[n] >> 8, web_color[n]);
+    }
+    ctx->pix_tab[pix] = t;
+    return t;
+}
+
+// 将整个文件映射到内存，解码时直接读取映射的数据，省去一次fread的拷贝，预读也交给操作系统完成
+// 失败时返回NULL，此时退回到fread的方式
+static const uint8_t *img_file_map(FILE *fp, int64_t size)
+{
+#if defined(IMG_USE_MMAP) && defined(_WIN32)
+    HANDLE file_handle;
+    HANDLE map_handle;
+    const uint8_t *map;
+
+    file_handle = (HANDLE)_get_osfhandle(_fileno(fp));
+    if (file_handle == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+    map_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_handle == NULL)
+    {
+        return NULL;
+    }
+    map = (const uint8_t *)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+    // 映射视图会保持对映射对象的引用，这里可以直接关闭句柄
+    CloseHandle(map_handle);
+    return map;
+#elif defined(IMG_USE_MMAP)
+    void *map;
+
+    // 32位系统的地址空间放不下整个文件，使用fread的方式
+    if ((uint64_t)size > SIZE_MAX)
+    {
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    return (const uint8_t *)map;
+#else
+    (void)fp;
+    (void)size;
+    return NULL;
+#endif
+}
+
+static void img_file_unmap(const uint8_t *map, int64_t size)
+{
+#if defined(IMG_USE_MMAP) && defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(map);
+#elif defined(IMG_USE_MMAP)
+    munmap((void *)map, (size_t)size);
+#else
+    (void)map;
+    (void)size;
+#endif
+}
+
 img_dec_ctx *img_dec_open(char *path)
 {
     FILE *img_fp;
-    int32_t file_size;
+    int64_t file_size = 0;
+    int32_t is_stream = 0;
     _img_dec_ctx *ctx;
 
-    img_fp = fopen(path, "rb");
+    // "-" 表示从标准输入读取
+    if (strcmp(path, "-") == 0)
+    {
+        img_fp = stdin;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+    else
+    {
+        img_fp = fopen(path, "rb");
+    }
     if (img_fp == NULL)
     {
         printf("can not open %s\n", path);
         return NULL;
     }
 
-    fseek(img_fp, 0, SEEK_END);
-    file_size = ftell(img_fp);
-    fseek(img_fp, 0, SEEK_SET);
-    if (file_size == 0)
+    // 管道等不能定位的文件，不知道大小，只能边读边解码
+    if (img_fseek(img_fp, 0, SEEK_END) != 0)
     {
-        printf("file %s size is zero!\n", path);
-        fclose(img_fp);
-        return NULL;
+        is_stream = 1;
+    }
+    else
+    {
+        file_size = img_ftell(img_fp);
+        img_fseek(img_fp, 0, SEEK_SET);
+        if (file_size <= 0)
+        {
+            printf("file %s size is zero!\n", path);
+            if (img_fp != stdin)
+            {
+                fclose(img_fp);
+            }
+            return NULL;
+        }
     }
 
     ctx = (_img_dec_ctx *)malloc(sizeof(_img_dec_ctx));
     if (ctx == NULL)
     {
         printf("create img_dec_ctx error\n");
-        fclose(img_fp);
+        if (img_fp != stdin)
+        {
+            fclose(img_fp);
+        }
         return NULL;
     }
     memset(ctx, 0, sizeof(_img_dec_ctx));
 
     ctx->fp = img_fp;
     ctx->file_size = file_size;
+    ctx->is_stream = is_stream;
     ctx->buf = NULL;
+    ctx->map = is_stream ? NULL : img_file_map(img_fp, file_size);
+    ctx->read_img_num = 0;
+    ctx->prefetch_num = 0;
 
     return ctx;
 }
 
+#ifdef IMG_USE_THREAD
+// 提前访问映射的内存，每页访问一个字节即可
+static void prefetch_touch(const uint8_t *p, int32_t size)
+{
+    volatile uint8_t sum = 0;
+    int32_t i = 0;
+
+    for (i = 0; i < size; i += 4096)
+    {
+        sum += p[i];
+    }
+    sum += p[size - 1];
+}
+
+static void *prefetch_thread(void *arg)
+{
+    _img_dec_ctx *ctx = (_img_dec_ctx *)arg;
+    img_prefetch *pf = &ctx->prefetch;
+    int32_t num = 0;
+    int32_t generation = 0;
+    int32_t ret = 0;
+    uint8_t *buf = NULL;
+
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->stop)
+    {
+        // 使用内存映射时解码不会等待预读，解码可能已经超过了预读的位置
+        if (pf->loaded < pf->start)
+        {
+            pf->loaded = pf->start;
+        }
+        if (pf->loaded >= pf->start + ctx->prefetch_num || pf->loaded >= ctx->sum_img_num)
+        {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+            continue;
+        }
+
+        num = pf->loaded;
+        generation = pf->generation;
+        pthread_mutex_unlock(&pf->lock);
+
+        ret = IMG_OK;
+        if (ctx->map)
+        {
+            prefetch_touch(ctx->map + img_dec_offset(ctx, num), ctx->img_size);
+        }
+        else
+        {
+            buf = pf->buf + (size_t)ctx->img_size * (num % ctx->prefetch_num);
+            ret = img_dec_read(ctx, num, buf);
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        if (generation == pf->generation && num == pf->loaded)
+        {
+            pf->ret[num % ctx->prefetch_num] = ret;
+            pf->loaded = num + 1;
+            pthread_cond_broadcast(&pf->cond);
+        }
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    return NULL;
+}
+
+static img_err_code prefetch_start(_img_dec_ctx *ctx)
+{
+    img_prefetch *pf = &ctx->prefetch;
+
+    memset(pf, 0, sizeof(img_prefetch));
+    if (ctx->map == NULL)
+    {
+        pf->buf = (uint8_t *)malloc((size_t)ctx->img_size * ctx->prefetch_num);
+    }
+    pf->ret = (int32_t *)malloc(sizeof(int32_t) * ctx->prefetch_num);
+    if ((ctx->map == NULL && pf->buf == NULL) || pf->ret == NULL)
+    {
+        printf("malloc prefetch buffer error\n");
+        goto err;
+    }
+    pf->start = ctx->read_img_num;
+    pf->loaded = ctx->read_img_num;
+
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    if (pthread_create(&pf->tid, NULL, prefetch_thread, ctx))
+    {
+        printf("create prefetch thread error\n");
+        pthread_cond_destroy(&pf->cond);
+        pthread_mutex_destroy(&pf->lock);
+        goto err;
+    }
+    pf->running = 1;
+    return IMG_OK;
+
+err:
+    free(pf->buf);
+    free(pf->ret);
+    pf->buf = NULL;
+    pf->ret = NULL;
+    return IMG_MEM_WRONG;
+}
+
+static void prefetch_stop(_img_dec_ctx *ctx)
+{
+    img_prefetch *pf = &ctx->prefetch;
+
+    if (!pf->running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->tid, NULL);
+
+    pthread_cond_destroy(&pf->cond);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf->buf);
+    free(pf->ret);
+    pf->buf = NULL;
+    pf->ret = NULL;
+    pf->running = 0;
+}
+
+// 从预读窗口中取出第 num 张图片，num 不在窗口内时窗口跳转到 num
+static img_err_code prefetch_get(_img_dec_ctx *ctx, int32_t num, const uint8_t **src)
+{
+    img_prefetch *pf = &ctx->prefetch;
+    img_err_code ret = IMG_OK;
+
+    pthread_mutex_lock(&pf->lock);
+    if (num < pf->start || num >= pf->start + ctx->prefetch_num)
+    {
+        pf->loaded = num;
+        pf->generation += 1;
+    }
+    // 窗口起点移动到 num 后，num 之前的缓存就可以用来读取新的图片了
+    pf->start = num;
+    pthread_cond_broadcast(&pf->cond);
+
+    if (ctx->map)
+    {
+        *src = ctx->map + img_dec_offset(ctx, num);
+    }
+    else
+    {
+        while (pf->loaded <= num)
+        {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        }
+        ret = pf->ret[num % ctx->prefetch_num];
+        *src = pf->buf + (size_t)ctx->img_size * (num % ctx->prefetch_num);
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    return ret;
+}
+#endif
+
+static void cache_free(_img_dec_ctx *ctx)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < ctx->cache_num; i++)
+    {
+        free(ctx->cache[i].data);
+    }
+    free(ctx->cache);
+    ctx->cache = NULL;
+    ctx->cache_num = 0;
+}
+
+// 按照当前的解码参数重新分配缓存，原有的缓存全部失效
+static img_err_code cache_alloc(_img_dec_ctx *ctx)
+{
+    int64_t out_size = (int64_t)ctx->rect.width * ctx->rect.height * 3;
+    int32_t i = 0;
+
+    cache_free(ctx);
+    if (ctx->cache_size <= 0 || out_size <= 0 || ctx->cache_size / out_size == 0 || ctx->sum_img_num <= 0)
+    {
+        return IMG_OK;
+    }
+
+    ctx->cache_num = ctx->cache_size / out_size > ctx->sum_img_num ? ctx->sum_img_num : ctx->cache_size / out_size;
+    ctx->cache = (img_cache_entry *)malloc(sizeof(img_cache_entry) * ctx->cache_num);
+    if (ctx->cache == NULL)
+    {
+        ctx->cache_num = 0;
+        printf("malloc img cache error\n");
+        return IMG_MEM_WRONG;
+    }
+    for (i = 0; i < ctx->cache_num; i++)
+    {
+        ctx->cache[i].img_num = -1;
+        ctx->cache[i].last_use = 0;
+        ctx->cache[i].data = NULL;
+    }
+
+    return IMG_OK;
+}
+
+// 查找缓存，找到时返回对应的缓存项，否则返回NULL
+static img_cache_entry *cache_find(_img_dec_ctx *ctx, int32_t num)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < ctx->cache_num; i++)
+    {
+        if (ctx->cache[i].img_num == num)
+        {
+            ctx->cache[i].last_use = ++ctx->cache_time;
+            return &ctx->cache[i];
+        }
+    }
+    return NULL;
+}
+
+// 为第num张图片分配一项缓存，缓存已满时替换最久未使用的一项，返回保存解码结果的内存，失败时返回NULL
+static uint8_t *cache_slot(_img_dec_ctx *ctx, int32_t num)
+{
+    img_cache_entry *entry = NULL;
+    int32_t out_size = ctx->rect.width * ctx->rect.height * 3;
+    int32_t i = 0;
+
+    if (ctx->cache_num == 0)
+    {
+        return NULL;
+    }
+    entry = &ctx->cache[0];
+    for (i = 1; i < ctx->cache_num && entry->img_num != -1; i++)
+    {
+        if (ctx->cache[i].img_num == -1 || ctx->cache[i].last_use < entry->last_use)
+        {
+            entry = &ctx->cache[i];
+        }
+    }
+
+    if (entry->data == NULL)
+    {
+        entry->data = (uint8_t *)malloc(out_size);
+        if (entry->data == NULL)
+        {
+            return NULL;
+        }
+    }
+    entry->img_num = num;
+    entry->last_use = ++ctx->cache_time;
+    return entry->data;
+}
+
 img_err_code img_dec_close(img_dec_ctx *img)
 {
+    int32_t i = 0;
     if (img == NULL)
     {
         return IMG_PARAM_NULL_PTR;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
 
+#ifdef IMG_USE_THREAD
+    prefetch_stop(ctx);
+#endif
+    cache_free(ctx);
+    for (i = 0; i < PIX_INVALID; i++)
+    {
+        SAFE_FREE(ctx->pix_tab[i]);
+    }
     if (ctx->buf)
     {
         free(ctx->buf);
     }
-    fclose(ctx->fp);
+    if (ctx->map)
+    {
+        img_file_unmap(ctx->map, ctx->file_size);
+    }
+    if (ctx->fp != stdin)
+    {
+        fclose(ctx->fp);
+    }
     free(ctx);
 
     return IMG_OK;
@@ -129,11 +741,18 @@ img_err_code img_dec_cfg(img_dec_ctx *img, img_dec_param *param)
         return IMG_PARAM_NULL_PTR;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    int64_t img_size = 0;
+    int64_t sum_img_num = 0;
 
-    if (param->format == 0 || param->format >= FMT_INVALID || param->height == 0 || param->width == 0)
+    if (param->format == 0 || param->format >= FMT_INVALID || param->height <= 0 || param->width <= 0 ||
+        param->file_offset < 0 || param->img_head_size < 0 || param->img_tail_size < 0)
     {
         return IMG_PARAM_INVALID;
     }
+#ifdef IMG_USE_THREAD
+    // 图片大小可能改变，预读线程需要重新启动
+    prefetch_stop(ctx);
+#endif
     ctx->param = *param;
 
     // 宽度或高度需要向上对8取整，例如15*9像素的图片，横向需要(15 / 8) * 9 = 18字节内存，纵向需要 15 * (9 / 8) = 30 字节内存
@@ -142,40 +761,71 @@ img_err_code img_dec_cfg(img_dec_ctx *img, img_dec_param *param)
         param->format == FMT_BITMAP_RCL ||
         param->format == FMT_BITMAP_RCM)
     {
-        ctx->img_size = param->height * ((param->width + 7) >> 3) + param->img_head_size + param->img_tail_size;
+        img_size = (int64_t)param->height * ((param->width + 7) >> 3);
     }
     else if (param->format == FMT_BITMAP_CL  ||
              param->format == FMT_BITMAP_CM  ||
              param->format == FMT_BITMAP_CRL ||
              param->format == FMT_BITMAP_CRM)
     {
-        ctx->img_size = ((param->height + 7) >> 3) * param->width + param->img_head_size + param->img_tail_size;
+        img_size = (int64_t)((param->height + 7) >> 3) * param->width;
     }
     else if (param->format == FMT_WEB)
     {
-        ctx->img_size = param->height * param->width + param->img_head_size + param->img_tail_size;
+        img_size = (int64_t)param->height * param->width;
     }
     else if (param->format >= FMT_RGB565 && param->format <= FMT_BGRA5551)
     {
-        ctx->img_size = param->height * param->width * 2 + param->img_head_size + param->img_tail_size;
+        img_size = (int64_t)param->height * param->width * 2;
     }
     else
     {
         return IMG_PARAM_INVALID;
     }
-    ctx->func = convert_list[param->format];
-    ctx->sum_img_num = (ctx->file_size - ctx->param.file_offset) / ctx->img_size;
+    // 单张图片仍然限制在2GB以内，只有文件大小和偏移量使用64位
+    img_size += (int64_t)param->img_head_size + param->img_tail_size;
+    if (img_size > INT32_MAX)
+    {
+        return IMG_PARAM_INVALID;
+    }
+    ctx->img_size = (int32_t)img_size;
+    ctx->func = param->is_big_endian ? convert_list_be[param->format] : convert_list[param->format];
+    // 管道的图片数量未知，解码到数据结束为止
+    // 偏移量超过文件末尾时图片数量为0，缓存、预读和拼图都不会看到负数
+    sum_img_num = ctx->is_stream ? INT32_MAX : (ctx->file_size - ctx->param.file_offset) / ctx->img_size;
+    sum_img_num = sum_img_num < 0 ? 0 : sum_img_num;
+    ctx->sum_img_num = sum_img_num > INT32_MAX ? INT32_MAX : (int32_t)sum_img_num;
     ctx->now_img_num = 0;
+    ctx->read_img_num = 0;
+    ctx->rect.x = 0;
+    ctx->rect.y = 0;
+    ctx->rect.width = param->width;
+    ctx->rect.height = param->height;
+    ctx->rect.step = 1;
     if (ctx->buf)
     {
         free(ctx->buf);
+        ctx->buf = NULL;
+    }
+    if (ctx->map == NULL)
+    {
+        ctx->buf = (uint8_t *)malloc(ctx->img_size);
+        if (ctx->buf == NULL)
+        {
+            printf("malloc img buffer error\n");
+            return IMG_MEM_WRONG;
+        }
     }
-    ctx->buf = (uint8_t *)malloc(ctx->img_size);
-    if (ctx->buf == NULL)
+    if (cache_alloc(ctx))
     {
-        printf("malloc img buffer error\n");
         return IMG_MEM_WRONG;
     }
+#ifdef IMG_USE_THREAD
+    if (ctx->prefetch_num > 0)
+    {
+        return prefetch_start(ctx);
+    }
+#endif
 
     return IMG_OK;
 }
@@ -197,7 +847,7 @@ int32_t img_dec_get_num(img_dec_ctx *img)
         return -1;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
-    return ctx->sum_img_num;
+    return ctx->is_stream ? -1 : ctx->sum_img_num;
 }
 
 img_err_code img_dec_seek(img_dec_ctx *img, img_seek_e seek, int32_t to)
@@ -207,7 +857,6 @@ img_err_code img_dec_seek(img_dec_ctx *img, img_seek_e seek, int32_t to)
         return IMG_PARAM_NULL_PTR;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
-    int32_t seek_addr = 0;
 
     if (seek == SEEK_PREV)
     {
@@ -231,6 +880,10 @@ img_err_code img_dec_seek(img_dec_ctx *img, img_seek_e seek, int32_t to)
     }
     else if (seek == SEEK_TAIL)
     {
+        if (ctx->is_stream)
+        {
+            return IMG_SEEK_ERR;
+        }
         ctx->now_img_num = ctx->sum_img_num - 1;
     }
     else if (seek == SEEK_GOTO)
@@ -246,322 +899,1114 @@ img_err_code img_dec_seek(img_dec_ctx *img, img_seek_e seek, int32_t to)
         return IMG_PARAM_INVALID;
     }
 
-    seek_addr = ctx->param.file_offset + ctx->img_size * ctx->now_img_num;
-    fseek(ctx->fp, seek_addr, SEEK_SET);
+    ctx->read_img_num = ctx->now_img_num;
 
     return IMG_OK;
 }
 
-int32_t img_dec_tell(img_dec_ctx *img)
+img_err_code img_dec_prefetch(img_dec_ctx *img, int32_t num)
 {
     if (img == NULL)
     {
-        return -1;
+        return IMG_PARAM_NULL_PTR;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
-    return ctx->now_img_num;
+    if (num < 0)
+    {
+        return IMG_PARAM_INVALID;
+    }
+
+#ifdef IMG_USE_THREAD
+    prefetch_stop(ctx);
+    ctx->prefetch_num = num;
+    // 还没有设置解码参数时，等到 img_dec_cfg 再启动
+    if (ctx->prefetch_num > 0 && ctx->img_size > 0)
+    {
+        return prefetch_start(ctx);
+    }
+    return IMG_OK;
+#else
+    (void)ctx;
+    return num == 0 ? IMG_OK : IMG_OTHER_ERR;
+#endif
 }
 
-img_err_code img_dec(img_dec_ctx *img, void *data, int32_t len)
+img_err_code img_dec_cache(img_dec_ctx *img, int64_t size)
 {
-    int32_t read_size = 0;
-    if (img == NULL || data == NULL)
+    if (img == NULL)
     {
         return IMG_PARAM_NULL_PTR;
     }
     _img_dec_ctx *ctx = (_img_dec_ctx *)img;
-    if (len < ctx->param.height * ctx->param.width * 3)
+    if (size < 0)
     {
-        return IMG_PARAM_OVERFLOW;
+        return IMG_PARAM_INVALID;
     }
 
-    read_size = fread(ctx->buf, 1, ctx->img_size, ctx->fp);
-    if (read_size != ctx->img_size)
+    ctx->cache_size = size;
+    ctx->cache_hit = 0;
+    ctx->cache_miss = 0;
+    // 还没有设置解码参数时，等到 img_dec_cfg 再分配
+    if (ctx->img_size > 0)
     {
-        return IMG_OTHER_ERR;
+        return cache_alloc(ctx);
     }
+    return IMG_OK;
+}
 
-    if (ctx->param.is_big_endian &&
-        (ctx->param.format == FMT_RGB565   ||
-         ctx->param.format == FMT_BGR565   ||
-         ctx->param.format == FMT_ARGB1555 ||
-         ctx->param.format == FMT_BGRA5551 ) )
+img_err_code img_dec_get_cache_stat(img_dec_ctx *img, int32_t *hit, int32_t *miss)
+{
+    if (img == NULL || hit == NULL || miss == NULL)
     {
-        uint16_t *d = (uint16_t *)ctx->buf;
-        const uint16_t *end = d + ctx->param.height * ctx->param.width;
-        while (d < end) {
-            *d = ((*d & 0x00FF) << 8) | ((*d & 0xFF00) >> 8);
-            d++;
-        }
+        return IMG_PARAM_NULL_PTR;
     }
-
-    ctx->func(ctx->buf + ctx->param.img_head_size, data, ctx->param.width, ctx->param.height);
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    *hit = ctx->cache_hit;
+    *miss = ctx->cache_miss;
 
     return IMG_OK;
 }
 
-static void bitmap_rl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+img_err_code img_dec_set_rect(img_dec_ctx *img, int32_t x, int32_t y, int32_t width, int32_t height, int32_t step)
 {
-    int32_t x = 0, y = 0;
-    int32_t he = 0;
-
-    memset(out, 0, h * v * 3);
-    he = (h + 7) >> 3;
-
-    for (y = 0; y < v; y++)
+    if (img == NULL)
     {
-        for (x = 0; x < h; x++)
-        {
-            if (in[he * y + (x >> 3)] & (0x01 << (x & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
-        }
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    if (ctx->img_size == 0)
+    {
+        return IMG_PARAM_INVALID;
     }
+    if (width == 0)
+    {
+        width = ctx->param.width - x;
+    }
+    if (height == 0)
+    {
+        height = ctx->param.height - y;
+    }
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || step < 1 ||
+        width > ctx->param.width - x || height > ctx->param.height - y)
+    {
+        return IMG_PARAM_INVALID;
+    }
+
+    ctx->rect.x = x;
+    ctx->rect.y = y;
+    ctx->rect.width = (width + step - 1) / step;
+    ctx->rect.height = (height + step - 1) / step;
+    ctx->rect.step = step;
+    // 输出尺寸变化，解码结果缓存要重新分配
+    return cache_alloc(ctx);
 }
 
-static void bitmap_rm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+img_err_code img_dec_get_out_size(img_dec_ctx *img, int32_t *width, int32_t *height)
 {
-    int32_t x = 0, y = 0;
-    int32_t he = 0;
+    if (img == NULL || width == NULL || height == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    *width = ctx->rect.width;
+    *height = ctx->rect.height;
 
-    memset(out, 0, h * v * 3);
-    he = (h + 7) >> 3;
+    return IMG_OK;
+}
 
-    for (y = 0; y < v; y++)
+int32_t img_dec_tell(img_dec_ctx *img)
+{
+    if (img == NULL)
     {
-        for (x = 0; x < h; x++)
-        {
-            if (in[he * y + (x >> 3)] & (0x80 >> (x & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
-        }
+        return -1;
     }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    return ctx->now_img_num;
 }
 
-static void bitmap_cl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 读取第 num 张图片的原始数据，src 指向读取到的数据
+static img_err_code img_dec_load(_img_dec_ctx *ctx, int32_t num, const uint8_t **src)
 {
-    int32_t x = 0, y = 0;
-    int32_t ve = 0;
+    img_err_code ret = IMG_OK;
 
-    memset(out, 0, h * v * 3);
-    ve = (v + 7) >> 3;
+    if (num < 0 || num >= ctx->sum_img_num)
+    {
+        return IMG_OTHER_ERR;
+    }
+#ifdef IMG_USE_THREAD
+    if (ctx->prefetch.running)
+    {
+        return prefetch_get(ctx, num, src);
+    }
+#endif
 
-    for (y = 0; y < v; y++)
+    if (ctx->map)
     {
-        for (x = 0; x < h; x++)
+        // 直接使用映射的数据，不再拷贝
+        *src = ctx->map + img_dec_offset(ctx, num);
+    }
+    else
+    {
+        ret = img_dec_read(ctx, num, ctx->buf);
+        if (ret)
         {
-            if (in[ve * x + (y >> 3)] & (0x01 << (y & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
+            return ret;
         }
+        *src = ctx->buf;
     }
+
+    return IMG_OK;
 }
 
-static void bitmap_cm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+img_err_code img_dec(img_dec_ctx *img, void *data, int32_t len)
 {
-    int32_t x = 0, y = 0;
-    int32_t ve = 0;
+    img_err_code ret = IMG_OK;
+    const uint8_t *src = NULL;
+    img_cache_entry *entry = NULL;
+    uint8_t *frame = NULL;
+    const dec_pix *pix = NULL;
+    if (img == NULL || data == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    if (len < ctx->rect.height * ctx->rect.width * 3)
+    {
+        return IMG_PARAM_OVERFLOW;
+    }
 
-    memset(out, 0, h * v * 3);
-    ve = (v + 7) >> 3;
+    if (ctx->cache_num > 0)
+    {
+        entry = cache_find(ctx, ctx->read_img_num);
+        if (entry)
+        {
+            memcpy(data, entry->data, ctx->rect.height * ctx->rect.width * 3);
+            ctx->cache_hit += 1;
+            ctx->read_img_num += 1;
+            return IMG_OK;
+        }
+        ctx->cache_miss += 1;
+    }
+
+    pix = dec_pix_get(ctx, PIX_RGB888);
+    if (pix == NULL)
+    {
+        return IMG_MEM_WRONG;
+    }
+    ret = img_dec_load(ctx, ctx->read_img_num, &src);
+    if (ret)
+    {
+        return ret;
+    }
+
+    ctx->func(src + ctx->param.img_head_size, data, ctx->rect.width * 3, ctx->param.width, ctx->param.height, &ctx->rect, pix);
+
+    frame = cache_slot(ctx, ctx->read_img_num);
+    if (frame)
+    {
+        memcpy(frame, data, ctx->rect.height * ctx->rect.width * 3);
+    }
+    ctx->read_img_num += 1;
 
-    for (y = 0; y < v; y++)
+    return IMG_OK;
+}
+
+// 拼图任务，每个任务解码一张图片，直接写入拼图中对应的格子
+typedef struct
+{
+    _img_dec_ctx *ctx;
+    uint8_t *out;
+    int32_t stride; // 拼图每行的字节数
+    int32_t cols; // 每行的格子数
+    dec_rect rect; // 缩小后的整张图片
+    const dec_pix *pix; // RGB888查找表，开始前生成，各线程只读
+#ifdef IMG_USE_THREAD
+    pthread_mutex_t lock; // 不使用内存映射时多个线程共用同一个文件指针
+#endif
+    img_err_code ret;
+} sheet_task;
+
+static void sheet_task_run(void *arg, int32_t num)
+{
+    sheet_task *task = (sheet_task *)arg;
+    _img_dec_ctx *ctx = task->ctx;
+    const uint8_t *src = NULL;
+    uint8_t *buf = NULL;
+    img_err_code ret = IMG_OK;
+    uint8_t *cell = task->out + (size_t)(num / task->cols) * task->rect.height * task->stride +
+                    (size_t)(num % task->cols) * task->rect.width * 3;
+
+    if (ctx->map)
     {
-        for (x = 0; x < h; x++)
+        src = ctx->map + img_dec_offset(ctx, num);
+    }
+    else
+    {
+        // 只有读文件需要加锁，解码可以同时进行
+        buf = (uint8_t *)malloc(ctx->img_size);
+        if (buf == NULL)
         {
-            if (in[ve * x + (y >> 3)] & (0x80 >> (y & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
+            ret = IMG_MEM_WRONG;
+        }
+        else
+        {
+#ifdef IMG_USE_THREAD
+            pthread_mutex_lock(&task->lock);
+#endif
+            ret = img_dec_read(ctx, num, buf);
+#ifdef IMG_USE_THREAD
+            pthread_mutex_unlock(&task->lock);
+#endif
+            src = buf;
         }
     }
+
+    if (ret == IMG_OK)
+    {
+        ctx->func(src + ctx->param.img_head_size, cell, task->stride, ctx->param.width, ctx->param.height, &task->rect, task->pix);
+    }
+    else
+    {
+#ifdef IMG_USE_THREAD
+        pthread_mutex_lock(&task->lock);
+#endif
+        task->ret = ret;
+#ifdef IMG_USE_THREAD
+        pthread_mutex_unlock(&task->lock);
+#endif
+    }
+    free(buf);
 }
 
-static void bitmap_rcl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+img_err_code img_dec_get_sheet_size(img_dec_ctx *img, int32_t cols, int32_t step, int32_t *width, int32_t *height)
 {
-    int32_t x = 0, y = 0;
+    if (img == NULL || width == NULL || height == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    int64_t w = 0, h = 0;
+    // 管道的图片数量未知，不能拼图；偏移量超过文件末尾时没有图片
+    if (ctx->img_size == 0 || ctx->is_stream || ctx->sum_img_num <= 0 || cols < 1 || step < 1)
+    {
+        return IMG_PARAM_INVALID;
+    }
 
-    memset(out, 0, h * v * 3);
+    // 图片数量最大为 INT32_MAX，加上 cols - 1 之后可能溢出，按64位计算
+    w = (int64_t)cols * ((ctx->param.width + step - 1) / step);
+    h = ((int64_t)ctx->sum_img_num + cols - 1) / cols * ((ctx->param.height + step - 1) / step);
+    if (w > INT32_MAX || h > INT32_MAX)
+    {
+        return IMG_PARAM_OVERFLOW;
+    }
+    *width = (int32_t)w;
+    *height = (int32_t)h;
+
+    return IMG_OK;
+}
+
+img_err_code img_dec_sheet(img_dec_ctx *img, void *data, int32_t len, int32_t cols, int32_t step, int32_t threads)
+{
+    img_err_code ret = IMG_OK;
+    sheet_task task;
+    int32_t width = 0, height = 0;
+    int32_t used = 0, y = 0;
+    if (img == NULL || data == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    ret = img_dec_get_sheet_size(img, cols, step, &width, &height);
+    if (ret)
+    {
+        return ret;
+    }
+    if ((int64_t)width * height * 3 > len)
+    {
+        return IMG_PARAM_OVERFLOW;
+    }
 
-    for (y = 0; y < v; y++)
+    memset(&task, 0, sizeof(task));
+    task.pix = dec_pix_get(ctx, PIX_RGB888);
+    if (task.pix == NULL)
+    {
+        return IMG_MEM_WRONG;
+    }
+    task.ctx = ctx;
+    task.out = (uint8_t *)data;
+    task.stride = width * 3;
+    task.cols = cols;
+    task.rect.width = (ctx->param.width + step - 1) / step;
+    task.rect.height = (ctx->param.height + step - 1) / step;
+    task.rect.step = step;
+
+    // 最后一行没有用到的格子填充为黑色
+    used = ctx->sum_img_num % cols;
+    if (used)
     {
-        for (x = 0; x < h; x++)
+        for (y = height - task.rect.height; y < height; y++)
         {
-            if (in[y + v * (x >> 3)] & (0x01 << (x & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
+            memset(task.out + (size_t)y * task.stride + used * task.rect.width * 3, 0, (cols - used) * task.rect.width * 3);
         }
     }
+
+#ifdef IMG_USE_THREAD
+    // 预读线程也会使用文件指针，先停止，完成后再从当前位置继续预读
+    prefetch_stop(ctx);
+    pthread_mutex_init(&task.lock, NULL);
+#endif
+    img_parallel_for(ctx->sum_img_num, threads, sheet_task_run, &task);
+#ifdef IMG_USE_THREAD
+    pthread_mutex_destroy(&task.lock);
+    if (ctx->prefetch_num > 0 && prefetch_start(ctx))
+    {
+        return IMG_MEM_WRONG;
+    }
+#endif
+
+    return task.ret;
+}
+
+// 一行RGB888转换为RGBA8888或BGRA8888，alpha固定为0xFF
+static void rgb888_to_rgba8888_c(const uint8_t *in, uint8_t *out, int32_t n, int32_t is_bgr)
+{
+    int32_t i = 0;
+    int32_t r = is_bgr ? 2 : 0;
+
+    for (i = 0; i < n; i++)
+    {
+        out[r]     = in[0];
+        out[1]     = in[1];
+        out[2 - r] = in[2];
+        out[3]     = 0xFF;
+        in += 3;
+        out += 4;
+    }
 }
 
-static void bitmap_rcm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+#ifdef IMG_USE_X86_SIMD
+// SSSE3 每次读取16字节，用pshufb把其中4个像素展开为16字节
+// 最后一组会多读4字节，所以结尾至少要留2个像素给C语言版本，返回已处理的像素数
+IMG_TARGET("ssse3")
+static int32_t rgb888_to_rgba8888_ssse3(const uint8_t *in, uint8_t *out, int32_t n, int32_t is_bgr)
 {
-    int32_t x = 0, y = 0;
+    const __m128i shuf_rgb = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i shuf_bgr = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i shuf = is_bgr ? shuf_bgr : shuf_rgb;
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    int32_t i = 0;
 
-    memset(out, 0, h * v * 3);
+    for (i = 0; i + 6 <= n; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)(in + i * 3));
+        p = _mm_or_si128(_mm_shuffle_epi8(p, shuf), alpha);
+        _mm_storeu_si128((__m128i *)(out + i * 4), p);
+    }
+    return i;
+}
+#endif
 
-    for (y = 0; y < v; y++)
+static void rgb888_to_rgba8888(const uint8_t *in, uint8_t *out, int32_t n, int32_t is_bgr)
+{
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    if (img_cpu_flags() & IMG_CPU_SSSE3)
     {
-        for (x = 0; x < h; x++)
+        done = rgb888_to_rgba8888_ssse3(in, out, n, is_bgr);
+    }
+#endif
+    rgb888_to_rgba8888_c(in + done * 3, out + done * 4, n - done, is_bgr);
+}
+
+// 与编码器的灰度计算方法相同
+static void rgb888_to_gray8(const uint8_t *in, uint8_t *out, int32_t n)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        out[i] = (in[0] * 76 + in[1] * 150 + in[2] * 29) >> 8;
+        in += 3;
+    }
+}
+
+static void rgb888_to_bgr888(const uint8_t *in, uint8_t *out, int32_t n)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        out[0] = in[2];
+        out[1] = in[1];
+        out[2] = in[0];
+        in += 3;
+        out += 3;
+    }
+}
+
+// 将连续存放的 rows 行RGB888数据转换为指定的输出格式，输出行距为 stride
+static void rgb888_rows_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t rows, img_pix_e pix)
+{
+    int32_t y = 0;
+
+    for (y = 0; y < rows; y++)
+    {
+        switch (pix)
         {
-            if (in[y + v * (x >> 3)] & (0x80 >> (x & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
+        case PIX_RGB888:
+            memcpy(out, in, h * 3);
+            break;
+        case PIX_BGR888:
+            rgb888_to_bgr888(in, out, h);
+            break;
+        case PIX_RGBA8888:
+            rgb888_to_rgba8888(in, out, h, 0);
+            break;
+        case PIX_BGRA8888:
+            rgb888_to_rgba8888(in, out, h, 1);
+            break;
+        case PIX_GRAY8:
+            rgb888_to_gray8(in, out, h);
+            break;
+        default:
+            return;
         }
+        in += h * 3;
+        out += stride;
     }
 }
 
-static void bitmap_crl_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+img_err_code img_dec_ex(img_dec_ctx *img, void *data, int32_t len, int32_t stride, img_pix_e pix)
 {
-    int32_t x = 0, y = 0;
+    img_err_code ret = IMG_OK;
+    const uint8_t *src = NULL;
+    img_cache_entry *entry = NULL;
+    uint8_t *frame = NULL;
+    uint8_t *out = (uint8_t *)data;
+    const dec_pix *out_pix = NULL;
+    const dec_pix *rgb_pix = NULL;
+    if (img == NULL || data == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    _img_dec_ctx *ctx = (_img_dec_ctx *)img;
+    int32_t h = ctx->param.width;
+    int32_t v = ctx->param.height;
+    int32_t out_w = ctx->rect.width;
+    int32_t out_h = ctx->rect.height;
+    if (pix < PIX_RGB888 || pix >= PIX_INVALID || stride < out_w * pix_bytes[pix])
+    {
+        return IMG_PARAM_INVALID;
+    }
+    if ((int64_t)stride * (out_h - 1) + out_w * pix_bytes[pix] > len)
+    {
+        return IMG_PARAM_OVERFLOW;
+    }
+
+    if (ctx->cache_num > 0)
+    {
+        entry = cache_find(ctx, ctx->read_img_num);
+        if (entry)
+        {
+            // 缓存中保存的是RGB888数据，其他格式需要再转换一次
+            rgb888_rows_to_pix(entry->data, out, stride, out_w, out_h, pix);
+            ctx->cache_hit += 1;
+            ctx->read_img_num += 1;
+            return IMG_OK;
+        }
+        ctx->cache_miss += 1;
+    }
+
+    out_pix = dec_pix_get(ctx, pix);
+    rgb_pix = dec_pix_get(ctx, PIX_RGB888);
+    if (out_pix == NULL || rgb_pix == NULL)
+    {
+        return IMG_MEM_WRONG;
+    }
+    ret = img_dec_load(ctx, ctx->read_img_num, &src);
+    if (ret)
+    {
+        return ret;
+    }
+    src += ctx->param.img_head_size;
+
+    // 开启缓存时只解码一次，保存RGB888数据到缓存中，再和命中缓存时一样转换为输出格式
+    frame = cache_slot(ctx, ctx->read_img_num);
+    if (frame)
+    {
+        ctx->func(src, frame, out_w * 3, h, v, &ctx->rect, rgb_pix);
+        rgb888_rows_to_pix(frame, out, stride, out_w, out_h, pix);
+    }
+    else
+    {
+        ctx->func(src, out, stride, h, v, &ctx->rect, out_pix);
+    }
+    ctx->read_img_num += 1;
+
+    return IMG_OK;
+}
 
-    memset(out, 0, h * v * 3);
+// 查表解码一行位图，输出从第x个点开始，每隔step个点取一个点，共w个点，in_step为同一行相邻两个字节的间隔
+// bytes 为每个像素的字节数，调用处都是常量，memcpy 的长度也是常量
+static inline void bitmap_row_to_pix_n(const uint8_t *in, int32_t in_step, uint8_t *out, int32_t x, int32_t w, int32_t step,
+                                       const uint8_t (*lut)[32], int32_t bytes)
+{
+    int32_t i = 0, n = 0;
 
-    for (y = 0; y < v; y++)
+    if (step > 1)
     {
-        for (x = 0; x < h; x++)
+        // 缩小时每个点单独查表，只读取用到的字节
+        for (i = 0; i < w; i++, x += step)
         {
-            if (in[x + h * (y >> 3)] & (0x01 << (y & 0x07)))
-            {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
-            }
+            memcpy(out, &lut[in[(x >> 3) * in_step]][(x & 7) * bytes], bytes);
+            out += bytes;
         }
+        return;
+    }
+
+    in += (x >> 3) * in_step;
+    // 起点不在字节边界时，第一个字节只输出后面几个点
+    if (x & 7)
+    {
+        n = 8 - (x & 7) < w ? 8 - (x & 7) : w;
+        memcpy(out, &lut[*in][(x & 7) * bytes], n * bytes);
+        in += in_step;
+        out += n * bytes;
+        w -= n;
+    }
+    for (i = 0; i + 8 <= w; i += 8)
+    {
+        memcpy(out, lut[*in], 8 * bytes);
+        in += in_step;
+        out += 8 * bytes;
+    }
+    // 行尾不足8个点
+    if (i < w)
+    {
+        memcpy(out, lut[*in], (w - i) * bytes);
     }
 }
 
-static void bitmap_crm_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void bitmap_row_to_pix(const uint8_t *in, int32_t in_step, uint8_t *out, int32_t x, int32_t w, int32_t step,
+                              const dec_pix *pix, int32_t is_msb)
 {
-    int32_t x = 0, y = 0;
+    const uint8_t (*lut)[32] = is_msb ? pix->bitmap_msb : pix->bitmap_lsb;
 
-    memset(out, 0, h * v * 3);
+    switch (pix->bytes)
+    {
+    case 1:
+        bitmap_row_to_pix_n(in, in_step, out, x, w, step, lut, 1);
+        break;
+    case 4:
+        bitmap_row_to_pix_n(in, in_step, out, x, w, step, lut, 4);
+        break;
+    default:
+        bitmap_row_to_pix_n(in, in_step, out, x, w, step, lut, 3);
+        break;
+    }
+}
+
+static void bitmap_rl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    int32_t i = 0;
+    int32_t he = (h + 7) >> 3;
+
+    (void)v;
+    for (i = 0; i < rect->height; i++)
+    {
+        bitmap_row_to_pix(&in[he * (rect->y + i * rect->step)], 1, &out[i * stride], rect->x, rect->width, rect->step, pix, 0);
+    }
+}
+
+static void bitmap_rm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    int32_t i = 0;
+    int32_t he = (h + 7) >> 3;
+
+    (void)v;
+    for (i = 0; i < rect->height; i++)
+    {
+        bitmap_row_to_pix(&in[he * (rect->y + i * rect->step)], 1, &out[i * stride], rect->x, rect->width, rect->step, pix, 1);
+    }
+}
 
-    for (y = 0; y < v; y++)
+// 8x8位矩阵转置，输入第r字节的第c位变为输出第c字节的第r位
+static uint64_t bitmap_transpose8(uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// 解码按列存储的位图，x列第yb组8个点所在的字节为 in[x_step * x + yb_step * yb]
+// 每次读取8列的同一组字节拼成8x8的位矩阵，转置后每个字节就是一行的8个点，再查表连续写出8行
+// 这样每个输入字节只读取一次，输出也是按行连续写入的，区域外的字节不会读取
+static inline void bitmap_col_to_pix_n(const uint8_t *in, int32_t x_step, int32_t yb_step, uint8_t *out, int32_t stride,
+                                       const dec_rect *rect, int32_t is_msb, const uint8_t (*lut)[32], int32_t bytes)
+{
+    int32_t xb = 0, yb = 0, i = 0;
+    int32_t cols = 0, first = 0, rows = 0;
+    int32_t x0 = rect->x, x1 = rect->x + rect->width;
+    int32_t y0 = rect->y, y1 = rect->y + rect->height;
+    int32_t x = 0, y = 0, bit = 0;
+    uint64_t m = 0;
+    uint8_t row = 0;
+    uint8_t *d = NULL;
+
+    if (rect->step > 1)
     {
-        for (x = 0; x < h; x++)
+        // 缩小时逐点读取，转置整组字节反而浪费
+        for (i = 0; i < rect->height; i++)
         {
-            if (in[x + h * (y >> 3)] & (0x80 >> (y & 0x07)))
+            y = rect->y + i * rect->step;
+            bit = is_msb ? 7 - (y & 7) : y & 7;
+            d = &out[i * stride];
+            for (x = rect->x; x < rect->x + rect->width * rect->step; x += rect->step)
             {
-                out[(y * h + x) * 3] = 0xFF;
-                out[(y * h + x) * 3 + 1] = 0xFF;
-                out[(y * h + x) * 3 + 2] = 0xFF;
+                // 查找表第0xFF项的第一个点为白色，第0项为黑色
+                memcpy(d, lut[((in[x_step * x + yb_step * (y >> 3)] >> bit) & 1) * 0xFF], bytes);
+                d += bytes;
             }
         }
+        return;
     }
+
+    for (yb = y0 >> 3; yb * 8 < y1; yb++)
+    {
+        // 这组8行中需要输出的行
+        first = y0 > yb * 8 ? y0 - yb * 8 : 0;
+        rows = y1 - yb * 8 < 8 ? y1 - yb * 8 : 8;
+        // 按列存储时每列的字节是独立的，起点不需要对齐到8
+        for (xb = x0; xb < x1; xb += 8)
+        {
+            cols = x1 - xb < 8 ? x1 - xb : 8;
+            m = 0;
+            for (i = 0; i < cols; i++)
+            {
+                m |= (uint64_t)in[x_step * (xb + i) + yb_step * yb] << (i * 8);
+            }
+            m = bitmap_transpose8(m);
+
+            for (i = first; i < rows; i++)
+            {
+                // MSB格式第一个点在最高位，转置后第i行在第7-i个字节
+                row = m >> ((is_msb ? 7 - i : i) * 8);
+                d = &out[(yb * 8 + i - y0) * stride + (xb - x0) * bytes];
+                if (cols == 8)
+                {
+                    memcpy(d, lut[row], 8 * bytes);
+                }
+                else
+                {
+                    memcpy(d, lut[row], cols * bytes);
+                }
+            }
+        }
+    }
+}
+
+// 转置后第一个点都在最低位，使用LSB查找表
+static void bitmap_col_to_pix(const uint8_t *in, int32_t x_step, int32_t yb_step, uint8_t *out, int32_t stride,
+                              const dec_rect *rect, int32_t is_msb, const dec_pix *pix)
+{
+    switch (pix->bytes)
+    {
+    case 1:
+        bitmap_col_to_pix_n(in, x_step, yb_step, out, stride, rect, is_msb, pix->bitmap_lsb, 1);
+        break;
+    case 4:
+        bitmap_col_to_pix_n(in, x_step, yb_step, out, stride, rect, is_msb, pix->bitmap_lsb, 4);
+        break;
+    default:
+        bitmap_col_to_pix_n(in, x_step, yb_step, out, stride, rect, is_msb, pix->bitmap_lsb, 3);
+        break;
+    }
+}
+
+static void bitmap_cl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)h;
+    bitmap_col_to_pix(in, (v + 7) >> 3, 1, out, stride, rect, 0, pix);
 }
 
-static void web_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void bitmap_cm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
 {
-    uint8_t *d          = out;
-    const uint8_t *s   = (const uint8_t *)in;
-    const uint8_t *end = s + h * v;
+    (void)h;
+    bitmap_col_to_pix(in, (v + 7) >> 3, 1, out, stride, rect, 1, pix);
+}
 
-    while (s < end) {
-        register uint8_t i = *s++;
-        *d++ = web_color[i] >> 16;
-        *d++ = web_color[i] >> 8;
-        *d++ = web_color[i];
+static void bitmap_rcl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    int32_t i = 0;
+
+    (void)h;
+    for (i = 0; i < rect->height; i++)
+    {
+        bitmap_row_to_pix(&in[rect->y + i * rect->step], v, &out[i * stride], rect->x, rect->width, rect->step, pix, 0);
     }
 }
 
-static void rgb565_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void bitmap_rcm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
 {
-    uint8_t *d          = out;
-    const uint16_t *s   = (const uint16_t *)in;
-    const uint16_t *end = s + h * v;
+    int32_t i = 0;
 
-    while (s < end) {
-        register uint16_t rgb = *s++;
-        *d++ = (rgb & 0xF800) >> 8;
-        *d++ = (rgb & 0x07E0) >> 3;
-        *d++ = (rgb & 0x001F) << 3;
-        // ffmpeg 里面这样写目的是对低几位的数据引入随机性，以消除颜色过渡不均带来的纹理
-        // *d++ = ((rgb & 0xF800) >> 8) | ((rgb & 0xF800) >> 13);
-        // *d++ = ((rgb & 0x07E0) >> 3) | ((rgb & 0x07E0) >> 9);
-        // *d++ = ((rgb & 0x001F) << 3) | ((rgb & 0x001F) >> 2);
+    (void)h;
+    for (i = 0; i < rect->height; i++)
+    {
+        bitmap_row_to_pix(&in[rect->y + i * rect->step], v, &out[i * stride], rect->x, rect->width, rect->step, pix, 1);
     }
 }
 
-static void bgr565_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void bitmap_crl_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    bitmap_col_to_pix(in, 1, h, out, stride, rect, 0, pix);
+}
+
+static void bitmap_crm_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
 {
-    uint8_t *d          = out;
-    const uint16_t *s   = (const uint16_t *)in;
-    const uint16_t *end = s + h * v;
+    (void)v;
+    bitmap_col_to_pix(in, 1, h, out, stride, rect, 1, pix);
+}
 
-    while (s < end) {
-        register uint16_t bgr = *s++;
-        *d++ = (bgr & 0x001F) << 3;
-        *d++ = (bgr & 0x07E0) >> 3;
-        *d++ = (bgr & 0xF800) >> 8;
-        // ffmpeg 里面这样写目的是对低几位的数据引入随机性，以消除颜色过渡不均带来的纹理
-        // *d++ = ((bgr & 0x001F) << 3) | ((bgr & 0x001F) >> 2);
-        // *d++ = ((bgr & 0x07E0) >> 3) | ((bgr & 0x07E0) >> 9);
-        // *d++ = ((bgr & 0xF800) >> 8) | ((bgr & 0xF800) >> 13);
+static inline void web_to_pix_n(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, const dec_rect *rect,
+                                 const uint8_t (*web)[4], int32_t bytes)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < rect->height; i++)
+    {
+        uint8_t *d          = out + i * stride;
+        const uint8_t *s   = in + (rect->y + i * rect->step) * h + rect->x;
+        const uint8_t *end = s + rect->width * rect->step;
+
+        while (s < end) {
+            memcpy(d, web[*s], bytes);
+            s += rect->step;
+            d += bytes;
+        }
     }
 }
 
-static void argb1555_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void web_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
 {
-    uint8_t *d          = out;
-    const uint16_t *s   = (const uint16_t *)in;
-    const uint16_t *end = s + h * v;
+    (void)v;
+    switch (pix->bytes)
+    {
+    case 1:
+        web_to_pix_n(in, out, stride, h, rect, pix->web, 1);
+        break;
+    case 4:
+        web_to_pix_n(in, out, stride, h, rect, pix->web, 4);
+        break;
+    default:
+        web_to_pix_n(in, out, stride, h, rect, pix->web, 3);
+        break;
+    }
+}
+
+// bytes 为每个像素的字节数，3为RGB888或BGR888，4为RGBA8888或BGRA8888，1为灰度
+static void rgb16_to_pix_c(const uint8_t *in, uint8_t *out, int32_t n, const rgb16_desc *desc, int32_t bytes)
+{
+    uint8_t *d         = out;
+    const uint8_t *s   = in;
+    const uint8_t *end = s + n * 2;
+    uint8_t r = 0, g = 0, b = 0;
 
     while (s < end) {
-        register uint16_t rgb = *s++;
-        if (rgb & 0x8000)
+        register uint32_t rgb = desc->is_big_endian ? (s[0] << 8) | s[1] : s[0] | (s[1] << 8);
+        s += 2;
+        if (desc->alpha && !(rgb & desc->alpha))
         {
-            *d++ = (rgb & 0x7C00) >> 7;
-            *d++ = (rgb & 0x03E0) >> 2;
-            *d++ = (rgb & 0x001F) << 3;
-            // ffmpeg 中的写法略
+            r = 0xFF;
+            g = 0xFF;
+            b = 0xFF;
         }
         else
         {
-            *d++ = 0xFF;
-            *d++ = 0xFF;
+            r = ((rgb & desc->mask[0]) * desc->mul[0]) >> 8;
+            g = ((rgb & desc->mask[1]) * desc->mul[1]) >> 8;
+            b = ((rgb & desc->mask[2]) * desc->mul[2]) >> 8;
+        }
+        // ffmpeg 里面会把高几位复制到低几位，目的是对低几位的数据引入随机性，以消除颜色过渡不均带来的纹理，例如rgb565的r分量：
+        // ((rgb & 0xF800) >> 8) | ((rgb & 0xF800) >> 13);
+        if (bytes == 1)
+        {
+            *d++ = (r * 76 + g * 150 + b * 29) >> 8;
+            continue;
+        }
+        *d++ = r;
+        *d++ = g;
+        *d++ = b;
+        if (bytes == 4)
+        {
             *d++ = 0xFF;
         }
     }
 }
 
-static void bgra5551_to_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+#ifdef IMG_USE_X86_SIMD
+// SSE2 一次处理8个像素，返回已处理的像素数，剩余的像素由 rgb16_to_pix_c 处理
+// 3字节格式每组4个像素拼成12字节后用16字节写入，多写的4字节会被下一组覆盖，所以结尾至少要留2个像素给C语言版本
+IMG_TARGET("sse2")
+static int32_t rgb16_to_pix_sse2(const uint8_t *in, uint8_t *out, int32_t n, const rgb16_desc *desc, int32_t bytes)
 {
-    uint8_t *d          = out;
-    const uint16_t *s   = (const uint16_t *)in;
-    const uint16_t *end = s + h * v;
+    int32_t i = 0;
+    const __m128i mask_r = _mm_set1_epi16(desc->mask[0]);
+    const __m128i mask_g = _mm_set1_epi16(desc->mask[1]);
+    const __m128i mask_b = _mm_set1_epi16(desc->mask[2]);
+    const __m128i mul_r = _mm_set1_epi16(desc->mul[0]);
+    const __m128i mul_g = _mm_set1_epi16(desc->mul[1]);
+    const __m128i mul_b = _mm_set1_epi16(desc->mul[2]);
+    const __m128i alpha = _mm_set1_epi16(desc->alpha);
+    const __m128i alpha_en = _mm_set1_epi16(desc->alpha ? 0x00FF : 0);
+    const __m128i alpha_out = _mm_set1_epi16((short)0xFF00);
+    const __m128i gray_r = _mm_set1_epi16(76);
+    const __m128i gray_g = _mm_set1_epi16(150);
+    const __m128i gray_b = _mm_set1_epi16(29);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i keep_lo = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+    const __m128i keep_hi = _mm_set_epi32(0x0000FFFF, 0xFF000000, 0x0000FFFF, 0xFF000000);
+    const __m128i keep_0_5 = _mm_set_epi32(0, 0, 0x0000FFFF, 0xFFFFFFFF);
+
+    for (i = 0; i + 10 <= n; i += 8)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)(in + i * 2));
+        __m128i r, g, b, t, rg, px;
+        int32_t k;
 
-    while (s < end) {
-        register uint16_t rgb = *s++;
-        if (rgb & 0x0001)
+        if (desc->is_big_endian)
         {
-            *d++ = (rgb & 0x003E) << 2;
-            *d++ = (rgb & 0x07C0) >> 3;
-            *d++ = (rgb & 0xF800) >> 8;
-            // ffmpeg 中的写法略
+            p = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
         }
-        else
+        r = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(p, mask_r), mul_r), 8);
+        g = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(p, mask_g), mul_g), 8);
+        b = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(p, mask_b), mul_b), 8);
+        // 透明像素的三个分量都置为0xFF
+        t = _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(p, alpha), zero), alpha_en);
+        r = _mm_or_si128(r, t);
+        g = _mm_or_si128(g, t);
+        b = _mm_or_si128(b, t);
+
+        if (bytes == 1)
         {
-            *d++ = 0xFF;
-            *d++ = 0xFF;
-            *d++ = 0xFF;
+            // 最大为 255 * 255，16位无符号数不会溢出
+            px = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, gray_r), _mm_mullo_epi16(g, gray_g)), _mm_mullo_epi16(b, gray_b));
+            px = _mm_srli_epi16(px, 8);
+            _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(px, px));
+            continue;
+        }
+
+        rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        if (bytes == 4)
+        {
+            // b 的高字节为alpha，交错后每个像素正好4字节
+            b = _mm_or_si128(b, alpha_out);
+            _mm_storeu_si128((__m128i *)(out + i * 4), _mm_unpacklo_epi16(rg, b));
+            _mm_storeu_si128((__m128i *)(out + i * 4 + 16), _mm_unpackhi_epi16(rg, b));
+            continue;
+        }
+
+        for (k = 0; k < 2; k++)
+        {
+            // 4个 0x00BBGGRR 像素压缩为连续的12字节
+            px = k ? _mm_unpackhi_epi16(rg, b) : _mm_unpacklo_epi16(rg, b);
+            px = _mm_or_si128(_mm_and_si128(px, keep_lo), _mm_and_si128(_mm_srli_epi64(px, 8), keep_hi));
+            px = _mm_or_si128(_mm_and_si128(px, keep_0_5), _mm_andnot_si128(keep_0_5, _mm_srli_si128(px, 2)));
+            _mm_storeu_si128((__m128i *)(out + i * 3 + k * 12), px);
+        }
+    }
+    return i;
+}
+
+// AVX2 一次处理16个像素，3字节格式用 pshufb 把每4个像素压缩为12字节，结尾同样至少留2个像素
+IMG_TARGET("avx2")
+static int32_t rgb16_to_pix_avx2(const uint8_t *in, uint8_t *out, int32_t n, const rgb16_desc *desc, int32_t bytes)
+{
+    int32_t i = 0;
+    const __m256i mask_r = _mm256_set1_epi16(desc->mask[0]);
+    const __m256i mask_g = _mm256_set1_epi16(desc->mask[1]);
+    const __m256i mask_b = _mm256_set1_epi16(desc->mask[2]);
+    const __m256i mul_r = _mm256_set1_epi16(desc->mul[0]);
+    const __m256i mul_g = _mm256_set1_epi16(desc->mul[1]);
+    const __m256i mul_b = _mm256_set1_epi16(desc->mul[2]);
+    const __m256i alpha = _mm256_set1_epi16(desc->alpha);
+    const __m256i alpha_en = _mm256_set1_epi16(desc->alpha ? 0x00FF : 0);
+    const __m256i alpha_out = _mm256_set1_epi16((short)0xFF00);
+    const __m256i gray_r = _mm256_set1_epi16(76);
+    const __m256i gray_g = _mm256_set1_epi16(150);
+    const __m256i gray_b = _mm256_set1_epi16(29);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+    for (i = 0; i + 18 <= n; i += 16)
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(in + i * 2));
+        __m256i r, g, b, t, rg, lo, hi;
+        uint8_t *d = NULL;
+
+        if (desc->is_big_endian)
+        {
+            p = _mm256_shuffle_epi8(p, swap);
+        }
+        r = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(p, mask_r), mul_r), 8);
+        g = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(p, mask_g), mul_g), 8);
+        b = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(p, mask_b), mul_b), 8);
+        t = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_and_si256(p, alpha), zero), alpha_en);
+        r = _mm256_or_si256(r, t);
+        g = _mm256_or_si256(g, t);
+        b = _mm256_or_si256(b, t);
+
+        if (bytes == 1)
+        {
+            lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, gray_r), _mm256_mullo_epi16(g, gray_g)),
+                                  _mm256_mullo_epi16(b, gray_b));
+            lo = _mm256_srli_epi16(lo, 8);
+            // packus 按128位分别处理，像素 0-7 和 8-15 分别在两个128位的低8字节，再合并到一起
+            lo = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, lo), 0xD8);
+            _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(lo));
+            continue;
+        }
+
+        rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        if (bytes == 4)
+        {
+            // unpack 按128位分别处理，lo 为像素 0-3 和 8-11，hi 为像素 4-7 和 12-15
+            b = _mm256_or_si256(b, alpha_out);
+            lo = _mm256_unpacklo_epi16(rg, b);
+            hi = _mm256_unpackhi_epi16(rg, b);
+            d = out + i * 4;
+            _mm_storeu_si128((__m128i *)(d +  0), _mm256_castsi256_si128(lo));
+            _mm_storeu_si128((__m128i *)(d + 16), _mm256_castsi256_si128(hi));
+            _mm_storeu_si128((__m128i *)(d + 32), _mm256_extracti128_si256(lo, 1));
+            _mm_storeu_si128((__m128i *)(d + 48), _mm256_extracti128_si256(hi, 1));
+            continue;
         }
+
+        lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, b), pack);
+        hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, b), pack);
+        d = out + i * 3;
+        _mm_storeu_si128((__m128i *)(d +  0), _mm256_castsi256_si128(lo));
+        _mm_storeu_si128((__m128i *)(d + 12), _mm256_castsi256_si128(hi));
+        _mm_storeu_si128((__m128i *)(d + 24), _mm256_extracti128_si256(lo, 1));
+        _mm_storeu_si128((__m128i *)(d + 36), _mm256_extracti128_si256(hi, 1));
+    }
+    return i;
+}
+#endif
+
+// 16位图像解码，根据CPU支持的指令集选择SIMD版本，剩余不足一组的像素用C语言版本处理
+static void rgb16_to_pix(const uint8_t *in, uint8_t *out, int32_t n, const rgb16_desc *desc, int32_t bytes)
+{
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    uint32_t cpu = img_cpu_flags();
+    if (cpu & IMG_CPU_AVX2)
+    {
+        done = rgb16_to_pix_avx2(in, out, n, desc, bytes);
+    }
+    else if (cpu & IMG_CPU_SSE2)
+    {
+        done = rgb16_to_pix_sse2(in, out, n, desc, bytes);
     }
+#endif
+    rgb16_to_pix_c(in + done * 2, out + done * bytes, n - done, desc, bytes);
+}
+
+// 按行解码16位图像，解码整行且输出行距等于行长度时整段一起处理，SIMD循环更长
+// 输出为BGR顺序时交换r、b分量的掩码和乘数，和RGB顺序共用同一套解码函数
+static void rgb16_rows_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, const dec_rect *rect,
+                              const rgb16_desc *fmt, const dec_pix *pix)
+{
+    int32_t i = 0, j = 0;
+    int32_t bytes = pix->bytes;
+    const uint8_t *s = NULL;
+    rgb16_desc desc = *fmt;
+
+    if (pix->pix == PIX_BGR888 || pix->pix == PIX_BGRA8888)
+    {
+        desc.mask[0] = fmt->mask[2];
+        desc.mask[2] = fmt->mask[0];
+        desc.mul[0] = fmt->mul[2];
+        desc.mul[2] = fmt->mul[0];
+    }
+
+    if (rect->step > 1)
+    {
+        for (i = 0; i < rect->height; i++)
+        {
+            s = in + ((rect->y + i * rect->step) * h + rect->x) * 2;
+            for (j = 0; j < rect->width; j++)
+            {
+                rgb16_to_pix_c(s + j * rect->step * 2, out + i * stride + j * bytes, 1, &desc, bytes);
+            }
+        }
+        return;
+    }
+    if (rect->x == 0 && rect->width == h && stride == h * bytes)
+    {
+        rgb16_to_pix(in + rect->y * h * 2, out, rect->height * h, &desc, bytes);
+        return;
+    }
+    for (i = 0; i < rect->height; i++)
+    {
+        rgb16_to_pix(in + ((rect->y + i) * h + rect->x) * 2, out + i * stride, rect->width, &desc, bytes);
+    }
+}
+
+static void rgb565_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &rgb565_desc, pix);
+}
+
+static void bgr565_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &bgr565_desc, pix);
+}
+
+static void argb1555_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &argb1555_desc, pix);
+}
+
+static void bgra5551_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &bgra5551_desc, pix);
+}
+
+static void rgb565be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &rgb565be_desc, pix);
+}
+
+static void bgr565be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &bgr565be_desc, pix);
+}
+
+static void argb1555be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &argb1555be_desc, pix);
+}
+
+static void bgra5551be_to_pix(const uint8_t *in, uint8_t *out, int32_t stride, int32_t h, int32_t v, const dec_rect *rect, const dec_pix *pix)
+{
+    (void)v;
+    rgb16_rows_to_pix(in, out, stride, h, rect, &bgra5551be_desc, pix);
 }
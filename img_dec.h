@@ -26,13 +26,23 @@ typedef enum {
     SEEK_INVALID,
 } img_seek_e;
 
+// img_dec_ex 的输出像素格式，多字节格式按内存中的字节顺序命名
+typedef enum {
+    PIX_RGB888 = 0,
+    PIX_BGR888,
+    PIX_RGBA8888, // alpha 固定为0xFF
+    PIX_BGRA8888,
+    PIX_GRAY8,
+    PIX_INVALID,
+} img_pix_e;
+
 typedef struct
 {
     fmt_e format; // 图像格式
     int32_t width; // 图片水平方向长度
     int32_t height; // 图片垂直方向长度
     int32_t is_big_endian; // 是否为大端格式，仅对rgb565等16位图像有效
-    int32_t file_offset; // 文件开头的偏移量
+    int64_t file_offset; // 文件开头的偏移量，支持超过2GB的文件
     int32_t img_head_size; // 单个图片的头部大小
     int32_t img_tail_size; // 单个图片的尾部大小
 } img_dec_param;
@@ -41,8 +51,9 @@ typedef void img_dec_ctx;
 
 /**
  * @brief 打开图片解码器
+ * @note 管道等不能定位的文件只能按顺序解码，图片数量未知，读到数据结束时 img_dec 返回 IMG_FILE_TAIL
  * 
- * @param path 待解码的文件路径
+ * @param path 待解码的文件路径，"-" 表示标准输入
  * @return img_dec_ctx* 解码器指针
  */
 img_dec_ctx *img_dec_open(char *path);
@@ -76,7 +87,7 @@ int32_t img_dec_get_size(img_dec_ctx *img);
  * @brief 获取当前文件内的图片数量
  * 
  * @param img 已打开的解码器
- * @return int32_t 图片的数量
+ * @return int32_t 图片的数量，管道输入时未知，返回-1
  */
 int32_t img_dec_get_num(img_dec_ctx *img);
 
@@ -90,6 +101,61 @@ int32_t img_dec_get_num(img_dec_ctx *img);
  */
 img_err_code img_dec_seek(img_dec_ctx *img, img_seek_e seek, int32_t to);
 
+/**
+ * @brief 设置预读的图片数量，解码当前图片的同时后台线程会提前读取之后的 num 张图片
+ * @note 适合按顺序浏览、保存图片序列，跳转到预读范围以外的图片时会从新位置重新预读
+ *       默认不预读，不支持多线程（定义了 IMG_NO_THREAD）时返回 IMG_OTHER_ERR
+ * 
+ * @param img 已打开的解码器
+ * @param num 预读的图片数量，0表示关闭预读
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_prefetch(img_dec_ctx *img, int32_t num);
+
+/**
+ * @brief 设置解码结果缓存的内存上限，再次解码已缓存的图片时直接复制缓存的数据
+ * @note 缓存按最近最少使用的顺序淘汰，适合来回浏览图片，img_dec_cfg 后缓存失效，默认不缓存
+ * 
+ * @param img 已打开的解码器
+ * @param size 缓存占用内存的上限，单位字节，0表示关闭缓存
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_cache(img_dec_ctx *img, int64_t size);
+
+/**
+ * @brief 获取缓存命中、未命中的次数，从上一次 img_dec_cache 开始计数
+ * 
+ * @param img 已打开的解码器
+ * @param hit 命中次数
+ * @param miss 未命中次数
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_get_cache_stat(img_dec_ctx *img, int32_t *hit, int32_t *miss);
+
+/**
+ * @brief 设置解码区域和缩小倍数，之后 img_dec 和 img_dec_ex 只输出这个区域，解码时也只读取需要的数据
+ * @note 需要在 img_dec_cfg 之后调用，img_dec_cfg 会恢复为整张图片，输出尺寸通过 img_dec_get_out_size 获取
+ * 
+ * @param img 已打开的解码器
+ * @param x 区域左上角的横坐标
+ * @param y 区域左上角的纵坐标
+ * @param width 区域宽度，0表示到图片右边缘
+ * @param height 区域高度，0表示到图片下边缘
+ * @param step 每隔step个点取一个点，1表示不缩小，输出尺寸为区域尺寸除以step向上取整
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_set_rect(img_dec_ctx *img, int32_t x, int32_t y, int32_t width, int32_t height, int32_t step);
+
+/**
+ * @brief 获取 img_dec 输出图片的尺寸
+ * 
+ * @param img 已打开的解码器
+ * @param width 输出宽度
+ * @param height 输出高度
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_get_out_size(img_dec_ctx *img, int32_t *width, int32_t *height);
+
 /**
  * @brief 获取当前图片序号
  * 
@@ -103,9 +169,48 @@ int32_t img_dec_tell(img_dec_ctx *img);
  * 
  * @param img 已打开的解码器
  * @param data 保存输出数据的缓存，数据格式为RGB888
- * @param len 输出缓存的大小，不小于 width * height * 3
+ * @param len 输出缓存的大小，不小于 width * height * 3，设置了解码区域时为输出尺寸
  * @return img_err_code 错误码
  */
 img_err_code img_dec(img_dec_ctx *img, void *data, int32_t len);
 
+/**
+ * @brief 解码图片，直接输出为指定的像素格式，省去调用者再转换一次
+ * @note 直接从原始数据解码为输出格式，不经过RGB888；开启解码结果缓存时先解码为RGB888保存到缓存中，再转换为输出格式
+ * 
+ * @param img 已打开的解码器
+ * @param data 保存输出数据的缓存
+ * @param len 输出缓存的大小，不小于 stride * (输出高度 - 1) + 输出宽度 * 每像素字节数
+ * @param stride 输出缓存每行的字节数，不小于 输出宽度 * 每像素字节数
+ * @param pix 输出像素格式
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_ex(img_dec_ctx *img, void *data, int32_t len, int32_t stride, img_pix_e pix);
+
+/**
+ * @brief 获取拼图的尺寸
+ * 
+ * @param img 已打开的解码器
+ * @param cols 每行的图片数量
+ * @param step 每隔step个点取一个点
+ * @param width 拼图宽度
+ * @param height 拼图高度
+ * @return img_err_code 错误码，输入为管道或没有图片时为 IMG_PARAM_INVALID，宽度或高度超过 INT32_MAX 时为 IMG_PARAM_OVERFLOW
+ */
+img_err_code img_dec_get_sheet_size(img_dec_ctx *img, int32_t cols, int32_t step, int32_t *width, int32_t *height);
+
+/**
+ * @brief 将文件中的所有图片缩小后按顺序拼成一张RGB888图片，用于快速浏览整个序列
+ * @note 多个线程同时解码，每张图片直接写入拼图中对应的位置，不影响 img_dec 的当前位置和解码区域
+ * 
+ * @param img 已打开的解码器
+ * @param data 保存拼图的缓存
+ * @param len 缓存的大小，不小于 width * height * 3，尺寸由 img_dec_get_sheet_size 获取
+ * @param cols 每行的图片数量
+ * @param step 每隔step个点取一个点，1表示不缩小
+ * @param threads 解码线程数
+ * @return img_err_code 错误码
+ */
+img_err_code img_dec_sheet(img_dec_ctx *img, void *data, int32_t len, int32_t cols, int32_t step, int32_t threads);
+
 #endif
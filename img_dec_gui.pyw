@@ -2,7 +2,7 @@
 
 '''
 gcc 编译dll
-gcc -shared -o img_dec.dll .\img_common.c .\img_dec.c
+gcc -shared -o img_dec.dll .\img_common.c .\img_dec.c -lpthread
 '''
 
 import tkinter as tk
@@ -26,7 +26,12 @@ SPINBOX_SIZE_MIN = 1
 SPINBOX_SIZE_MAX = 2000
 
 SPINBOX_OFFSET_MIN = 0
-SPINBOX_OFFSET_MAX = 2147483647
+SPINBOX_OFFSET_MAX = 9007199254740991
+
+# 浏览图片时后台预读的图片数量
+PREFETCH_NUM = 8
+# 缓存已解码图片占用的内存上限，来回翻看时不用重新解码
+CACHE_SIZE = 256 * 1024 * 1024
 
 
 # ---------------- dll 加载及相关设置 ----------------
@@ -57,7 +62,7 @@ class IMG_DEC_PARAM(Structure):
         ("width", c_int),
         ("height", c_int),
         ("is_big_endian", c_int),
-        ("file_offset", c_int),
+        ("file_offset", c_int64),
         ("img_head_size", c_int),
         ("img_tail_size", c_int)
     ]
@@ -85,6 +90,12 @@ img_dec_dll.img_dec_get_num.restype = c_int
 img_dec_dll.img_dec_seek.argtypes = [c_void_p, c_int, c_int]
 img_dec_dll.img_dec_seek.restype = c_int
 
+img_dec_dll.img_dec_prefetch.argtypes = [c_void_p, c_int]
+img_dec_dll.img_dec_prefetch.restype = c_int
+
+img_dec_dll.img_dec_cache.argtypes = [c_void_p, c_int64]
+img_dec_dll.img_dec_cache.restype = c_int
+
 img_dec_dll.img_dec_tell.argtypes = [c_void_p]
 img_dec_dll.img_dec_tell.restype = c_int
 
@@ -169,6 +180,8 @@ def open_file():
     inputfile = create_string_buffer(file_path.encode("gbk"))
     img_dec_ptr = img_dec_dll.img_dec_open(inputfile)
     if (bool(img_dec_ptr)):
+        img_dec_dll.img_dec_prefetch(img_dec_ptr, PREFETCH_NUM)
+        img_dec_dll.img_dec_cache(img_dec_ptr, CACHE_SIZE)
         lb_status_content.config(text="打开完成")
         entry_img_file.config(state="readonly")
         bt_select_file.configure(state="disabled")
@@ -19,10 +19,28 @@
 
 #define SAFE_FREE(p) do { if (NULL != (p)){ free(p); (p) = NULL; } }while(0)
 
-typedef uint8_t pixel_rgb888[3];
-typedef int8_t pixel_rgb_err[3];
+#ifdef IMG_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef IMG_USE_THREAD
+#include <sched.h>
+// 抖动的各行之间通过已完成的像素数同步
+#define img_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define img_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define img_atomic_fetch_inc(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#define img_yield() sched_yield()
+#else
+#define img_atomic_load(p) (*(p))
+#define img_atomic_store(p, v) (*(p) = (v))
+#define img_atomic_fetch_inc(p) ((*(p))++)
+#define img_yield()
+#endif
+
 
 typedef void(*convert)(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
+static void bitmap_pack_band(const uint8_t *in, int32_t stride, uint8_t *out, int32_t h, int32_t v, int32_t y,
+                             int32_t rows, fmt_e format);
 static void rgb888_to_bitmap_rl(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
 static void rgb888_to_bitmap_rm(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
 static void rgb888_to_bitmap_cl(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
@@ -32,10 +50,6 @@ static void rgb888_to_bitmap_rcm(uint8_t *in, uint8_t *out, int32_t h, int32_t v
 static void rgb888_to_bitmap_crl(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
 static void rgb888_to_bitmap_crm(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
 static void rgb888_to_web(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void rgb888_to_rgb565(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void rgb888_to_bgr565(uint8_t *in, uint8_t *out, int32_t h, int32_t v);
-static void rgb888_to_argb1555(uint8_t *in, uint8_t *out, int32_t h, int32_t v, uint32_t transparence);
-static void rgb888_to_bgra5551(uint8_t *in, uint8_t *out, int32_t h, int32_t v, uint32_t transparence);
 
 static const convert convert_list[] = {
     NULL,
@@ -48,12 +62,11 @@ static const convert convert_list[] = {
     rgb888_to_bitmap_crl,
     rgb888_to_bitmap_crm,
     rgb888_to_web,
-    rgb888_to_rgb565,
-    rgb888_to_bgr565,
-    // rgb888_to_bgra5551,
-    // rgb888_to_argb1555,
 };
 
+// 16位格式的转换函数，n为像素数，transparence为透明色
+typedef void(*convert_rgb16)(const uint8_t *in, uint8_t *out, int32_t n, uint32_t transparence);
+
 
 typedef enum
 {
@@ -72,6 +85,17 @@ typedef struct
     uint8_t *buf;
 } _img_buf;
 
+// 预处理的各个步骤，按执行顺序排列
+typedef enum
+{
+    STAGE_GRAY, // rgb转灰度，仅bitmap格式
+    STAGE_LUMINANCE, // 亮度、对比度，仅bitmap格式
+    STAGE_EDGE, // 边缘识别，仅bitmap格式
+    STAGE_DITHER, // 抖动
+    STAGE_INVERT, // 反色，仅bitmap格式
+    STAGE_NUM,
+} _stage_e;
+
 typedef struct
 {
     uint32_t width; // 最终输出图片的宽度（预览图和它保持一致）
@@ -79,41 +103,18 @@ typedef struct
     int32_t img_size; // 最终输出图片的大小
     int32_t img_size_preview; // 预览图片的大小
     _img_buf in_buf; // 输入的图片原始数据，后续处理步骤不要修改这里的数据
-    _img_buf effect_buf_prev; // 保存处理前的图片数据，每一步处理完成后，这两者互相调换
-    _img_buf effect_buf_next; // 保存处理后的图片数据，每一步处理完成后，这两者互相调换
-    convert func;
+    _img_buf stage_buf[STAGE_NUM]; // 各步骤的处理结果，步骤第一次执行时分配
+    _img_buf *stage_out[STAGE_NUM]; // 各步骤的输出，未执行的步骤指向上一步的输出，stage_out[STAGE_NUM - 1] 为最终图像
+    int32_t stage_valid; // 前 stage_valid 个步骤的输出仍然有效，修改参数后只需从受影响的步骤开始重新计算
+    uint8_t luminance_lut[256]; // 亮度、对比度查找表，img_enc_cfg 时根据参数生成
+    int32_t lut_valid; // luminance_lut 是否已经生成
+    int32_t threads; // 边缘识别、抖动使用的线程数
+    convert func; // bitmap、web格式的转换函数
+    convert_rgb16 func_rgb16; // 16位格式的转换函数，按格式、字节序、是否使用透明色选择
     img_enc_param param;
 } _img_enc_ctx;
 
 
-// 图像边缘识别算子
-typedef struct {
-    int32_t num;
-    int32_t size;
-    char core[2][4][4];
-} operator;
-
-// 索贝尔算子
-operator Sobel = {
-    .num = 2,
-    .size = 3,
-    .core = {
-        {
-            {-1, 0, 1, 0},
-            {-2, 0, 2, 0},
-            {-1, 0, 1, 0},
-            { 0, 0, 0, 0},
-        },
-        {
-            {-1, -2, -1, 0},
-            { 0,  0,  0, 0},
-            { 1,  2,  1, 0},
-            { 0,  0,  0, 0},
-        }
-    }
-};
-
-
 // 位图文件头
 typedef struct _BMP_FILE_HEAD
 {
@@ -209,71 +210,151 @@ static img_err_code load_bmp_info(FILE *fp, BMP_HEAD *bh)
     return IMG_OK;
 }
 
+// 原地交换每个像素的第一、三个字节，bgr888和rgb888互相转换
+static void bgr888_swap_c(uint8_t *buf, int32_t n)
+{
+    int32_t i = 0;
+    uint8_t t = 0;
+
+    for (i = 0; i < n * 3; i += 3)
+    {
+        t = buf[i];
+        buf[i] = buf[i + 2];
+        buf[i + 2] = t;
+    }
+}
+
+#ifdef IMG_USE_X86_SIMD
+// 每16个像素占48字节，分三次读取，第o次写入的16字节由第o-1、o、o+1次读取的数据用pshufb拼成，-1的位置置0
+static const int8_t bgr_shuf[3][3][16] = {
+    {
+        { 2,  1,  0,  5,  4,  3,  8,  7,  6, 11, 10,  9, 14, 13, 12, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    },
+    {
+        {-1, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        { 0, -1,  4,  3,  2,  7,  6,  5, 10,  9,  8, 13, 12, 11, -1, 15},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0, -1},
+    },
+    {
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1,  3,  2,  1,  6,  5,  4,  9,  8,  7, 12, 11, 10, 15, 14, 13},
+    },
+};
+
+// SSSE3 一次处理16个像素，返回已处理的像素数
+IMG_TARGET("ssse3")
+static int32_t bgr888_swap_ssse3(uint8_t *buf, int32_t n)
+{
+    __m128i shuf[3][3];
+    __m128i x[3];
+    int32_t i = 0, k = 0;
+
+    for (k = 0; k < 9; k++)
+    {
+        shuf[k / 3][k % 3] = _mm_loadu_si128((const __m128i *)bgr_shuf[k / 3][k % 3]);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        for (k = 0; k < 3; k++)
+        {
+            x[k] = _mm_loadu_si128((const __m128i *)(buf + i * 3 + k * 16));
+        }
+        _mm_storeu_si128((__m128i *)(buf + i * 3),
+                         _mm_or_si128(_mm_shuffle_epi8(x[0], shuf[0][0]), _mm_shuffle_epi8(x[1], shuf[0][1])));
+        _mm_storeu_si128((__m128i *)(buf + i * 3 + 16),
+                         _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x[0], shuf[1][0]), _mm_shuffle_epi8(x[1], shuf[1][1])),
+                                      _mm_shuffle_epi8(x[2], shuf[1][2])));
+        _mm_storeu_si128((__m128i *)(buf + i * 3 + 32),
+                         _mm_or_si128(_mm_shuffle_epi8(x[1], shuf[2][1]), _mm_shuffle_epi8(x[2], shuf[2][2])));
+    }
+    return i;
+}
+#endif
+
+static void bgr888_swap(uint8_t *buf, int32_t n)
+{
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    if (img_cpu_flags() & IMG_CPU_SSSE3)
+    {
+        done = bgr888_swap_ssse3(buf, n);
+    }
+#endif
+    bgr888_swap_c(buf + done * 3, n - done);
+}
+
+// BMP从下到上逐行存储，每行直接读到 img->buf 中翻转后的位置，再原地转为rgb，不需要整幅图像的临时内存
 static img_err_code load_bmp_data(FILE *fp, BMP_HEAD *bh, _img_buf *img)
 {
     uint32_t stride = 0;
-    uint32_t bmp_data_size = 0;
-    uint32_t read_size = 0;
-    uint32_t offset = 0;
-    uint32_t h = 0, v = 0, i = 0, j = 0;
-    uint8_t *bmp_data = NULL;
+    uint32_t row_size = 0;
+    uint32_t h = 0, v = 0, i = 0;
+    uint8_t *row = NULL;
+    uint8_t pad[4];
 
     h = bh->bih.biWidth;
     v = bh->bih.biHeight;
 
     // BMP图像每行4字节取整向上对齐
+    row_size = h * 3;
     stride = ((h * 3 + 3) >> 2) << 2;
 
-    bmp_data_size = bh->bih.biSizeImage == 0 ? stride * v : bh->bih.biSizeImage;
-    bmp_data = (uint8_t *)malloc(bmp_data_size);
-    if (bmp_data == NULL)
+    if (fseek(fp, bh->bfh.bfOffBits, SEEK_SET) != 0)
     {
-        return IMG_MEM_WRONG;
-    }
-
-    fseek(fp, bh->bfh.bfOffBits, SEEK_SET);
-    read_size = fread(bmp_data, 1, bmp_data_size, fp);
-    if (read_size != bmp_data_size)
-    {
-        SAFE_FREE(bmp_data);
         return IMG_FORMAT_ERR;
     }
-
-    // 翻转顺序
     for (i = 0; i < v; i++)
     {
-        for (j = 0; j < h; j++)
+        row = &img->buf[(v - i - 1) * row_size];
+        if (fread(row, 1, row_size, fp) != row_size ||
+            fread(pad, 1, stride - row_size, fp) != stride - row_size)
         {
-            offset = (v - i - 1) * stride + j * 3;
-
-            img->buf[i * h * 3 + j * 3]     = bmp_data[offset + 2];
-            img->buf[i * h * 3 + j * 3 + 1] = bmp_data[offset + 1];
-            img->buf[i * h * 3 + j * 3 + 2] = bmp_data[offset];
+            return IMG_FORMAT_ERR;
         }
+        bgr888_swap(row, h);
     }
     img->color = COLOR_RGB888;
     img->height = bh->bih.biHeight;
     img->width = bh->bih.biWidth;
 
-    SAFE_FREE(bmp_data);
     return IMG_OK;
 }
 
+// web颜色每个分量的量化级数0~5，对应的颜色值为级数*51，编码、预览、误差扩散共用
+// 0,26,77,128,179,229,255 量化相对而言效果略好
+// 0,42,85,128,170,213,255 量化最简单直接
+// 即 (c + 26) / 51，c+26 不超过281，SIMD 中用 (c + 26) * 1286 >> 16 计算，结果完全一致
+static const uint8_t web_level[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+};
+
 // rgb888转为以rgb888格式保存的web颜色，仅预览使用
 static void rgb8882rgb888_web(uint8_t *in, int32_t h, int32_t v)
 {
-    static uint8_t color_table[6] = {0x00, 0x33, 0x66, 0x99, 0xcc, 0xff};
     int32_t i = 0;
-    int32_t color_id = 0;
-    uint8_t color = 0;
 
     for (i = 0; i < h * v * 3; i++)
     {
-        // 0,26,77,128,179,229,255 量化相对而言效果略好
-        // 0,42,85,128,170,213,255 量化最简单直接
-        color = in[i];
-        color_id = color > 229 ? 5 : (color + 26) / 51;
-        in[i] = color_table[color_id];
+        in[i] = web_level[in[i]] * 51;
     }
     return;
 }
@@ -289,7 +370,7 @@ static void rgb8882rgb888_rgb555(uint8_t *in, int32_t h, int32_t v)
     return;
 }
 
-static void rgb8882gray(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void rgb8882gray_c(const uint8_t *in, uint8_t *out, int32_t n)
 {
     // 参考资料
     // https://www.cnblogs.com/zhangjiansheng/p/6925722.html
@@ -299,7 +380,7 @@ static void rgb8882gray(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
     int32_t y = 0;
     int32_t i = 0;
     int32_t j = 0;
-    for (i = 0; i < h * v * 3; i += 3)
+    for (i = 0; i < n * 3; i += 3)
     {
         y = (in[i+0]*76 + in[i+1]*150 + in[i+2]*29) >> 8;
         out[j] = y;
@@ -308,12 +389,135 @@ static void rgb8882gray(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
     return;
 }
 
+#ifdef IMG_USE_X86_SIMD
+// 每16个像素占48字节，分三次读取，用pshufb把r、g、b分别取出并扩展为16位，灰度化和web编码共用
+// 76R+150G+29B 最大为65025，16位无符号数不会溢出，计算结果与C语言版本完全一致
+// pshufb 的参数，依次为从a、b、b、c中取出r、g、b的位置，-1的位置置0
+static const int8_t rgb_shuf[4][3][16] = {
+    {
+        { 0, -1,  3, -1,  6, -1,  9, -1, 12, -1, 15, -1, -1, -1, -1, -1},
+        { 1, -1,  4, -1,  7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1},
+        { 2, -1,  5, -1,  8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1},
+    },
+    {
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2, -1,  5, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0, -1,  3, -1,  6, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1, -1,  4, -1,  7, -1},
+    },
+    {
+        { 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        { 9, -1, 12, -1, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {10, -1, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    },
+    {
+        {-1, -1, -1, -1, -1, -1,  1, -1,  4, -1,  7, -1, 10, -1, 13, -1},
+        {-1, -1, -1, -1, -1, -1,  2, -1,  5, -1,  8, -1, 11, -1, 14, -1},
+        {-1, -1, -1, -1,  0, -1,  3, -1,  6, -1,  9, -1, 12, -1, 15, -1},
+    },
+};
+
+// SSSE3 一次处理16个像素，返回已处理的像素数，剩余的像素由 rgb8882gray_c 处理
+IMG_TARGET("ssse3")
+static int32_t rgb8882gray_ssse3(const uint8_t *in, uint8_t *out, int32_t n)
+{
+    const __m128i mul[3] = {_mm_set1_epi16(76), _mm_set1_epi16(150), _mm_set1_epi16(29)};
+    __m128i shuf[4][3];
+    int32_t i = 0, k = 0;
+
+    for (k = 0; k < 12; k++)
+    {
+        shuf[k / 3][k % 3] = _mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i * 3));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i * 3 + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i * 3 + 32));
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        // lo 为像素0-7，hi 为像素8-15
+        for (k = 0; k < 3; k++)
+        {
+            __m128i x0 = _mm_or_si128(_mm_shuffle_epi8(a, shuf[0][k]), _mm_shuffle_epi8(b, shuf[1][k]));
+            __m128i x1 = _mm_or_si128(_mm_shuffle_epi8(b, shuf[2][k]), _mm_shuffle_epi8(c, shuf[3][k]));
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(x0, mul[k]));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(x1, mul[k]));
+        }
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+// AVX2 一次处理32个像素，低128位处理像素0-15，高128位处理像素16-31，pack之后顺序正好连续
+IMG_TARGET("avx2")
+static int32_t rgb8882gray_avx2(const uint8_t *in, uint8_t *out, int32_t n)
+{
+    const __m256i mul[3] = {_mm256_set1_epi16(76), _mm256_set1_epi16(150), _mm256_set1_epi16(29)};
+    __m256i shuf[4][3];
+    int32_t i = 0, k = 0;
+
+    for (k = 0; k < 12; k++)
+    {
+        shuf[k / 3][k % 3] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]));
+    }
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        const uint8_t *s = in + i * 3;
+        __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s +  0))),
+                                            _mm_loadu_si128((const __m128i *)(s + 48)), 1);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 16))),
+                                            _mm_loadu_si128((const __m128i *)(s + 64)), 1);
+        __m256i c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 32))),
+                                            _mm_loadu_si128((const __m128i *)(s + 80)), 1);
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+
+        for (k = 0; k < 3; k++)
+        {
+            __m256i x0 = _mm256_or_si256(_mm256_shuffle_epi8(a, shuf[0][k]), _mm256_shuffle_epi8(b, shuf[1][k]));
+            __m256i x1 = _mm256_or_si256(_mm256_shuffle_epi8(b, shuf[2][k]), _mm256_shuffle_epi8(c, shuf[3][k]));
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(x0, mul[k]));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(x1, mul[k]));
+        }
+        lo = _mm256_srli_epi16(lo, 8);
+        hi = _mm256_srli_epi16(hi, 8);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_packus_epi16(lo, hi));
+    }
+    return i;
+}
+#endif
+
+// 根据CPU支持的指令集选择SIMD版本，剩余不足一组的像素用C语言版本处理
+static void rgb8882gray(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    int32_t n = h * v;
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    uint32_t cpu = img_cpu_flags();
+    if (cpu & IMG_CPU_AVX2)
+    {
+        done = rgb8882gray_avx2(in, out, n);
+    }
+    else if (cpu & IMG_CPU_SSSE3)
+    {
+        done = rgb8882gray_ssse3(in, out, n);
+    }
+#endif
+    rgb8882gray_c(in + done * 3, out + done, n - done);
+}
+
+// 从后往前转换，in和out可以是同一块内存
 static void gray2rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
 {
     int32_t i = 0;
-    for (i = 0; i < h * v; i++)
+    for (i = h * v - 1; i >= 0; i--)
     {
-        out[i*3+0] = out[i*3+1] = out[i*3+2] = in[i];
+        out[i*3+2] = out[i*3+1] = out[i*3+0] = in[i];
     }
     return;
 }
@@ -330,121 +534,562 @@ static void gray2binarization(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
 
 // 线性调整亮度、对比度，效果肯定不如ps之类的专业软件，但能凑合用
 // 亮度和对比度的默认值都是0，取值范围+-100
-static void gray_luminance(uint8_t *in, uint8_t *out, int32_t h, int32_t v, int32_t luminance, int32_t contrast)
+// 结果只和灰度值有关，预先计算出256个灰度值对应的结果，处理图像时直接查表
+static void luminance_lut_init(uint8_t *lut, int32_t luminance, int32_t contrast)
 {
-    int32_t i, j;
+    int32_t i;
     int32_t tmp;
 
-    for (i = 0; i < v; i++)
+    for (i = 0; i < 256; i++)
     {
-        for (j = 0; j < h; j++)
+        tmp = i;
+
+        if (luminance > 0)
         {
-            tmp = in[i*h+j];
+            tmp = (tmp-255) * 100 / (luminance + 100) + 255;
+        }
+        if (luminance < 0)
+        {
+            tmp = (tmp) * 100 / (-luminance + 100);
+        }
 
-            if (luminance > 0)
-            {
-                tmp = (tmp-255) * 100 / (luminance + 100) + 255;
-            }
-            if (luminance < 0)
-            {
-                tmp = (tmp) * 100 / (-luminance + 100);
-            }
+        if (contrast > 0)
+        {
+            tmp = (tmp-128) * (contrast + 100) / 100 + 128;
+        }
+        if (contrast < 0)
+        {
+            tmp = (tmp-128) * 100 / (-contrast + 100) + 128;
+        }
 
-            if (contrast > 0)
-            {
-                tmp = (tmp-128) * (contrast + 100) / 100 + 128;
-            }
-            if (contrast < 0)
-            {
-                tmp = (tmp-128) * 100 / (-contrast + 100) + 128;
-            }
+        if (tmp > 255) {tmp = 255;}
+        if (tmp < 0) {tmp = 0;}
+        lut[i] = tmp;
+    }
 
-            if (tmp > 255) {tmp = 255;}
-            if (tmp < 0) {tmp = 0;}
-            out[i*h+j] = tmp;
-        }
+    return;
+}
+
+// 按查找表转换灰度值，in和out可以是同一块内存
+static void gray_luminance(uint8_t *in, uint8_t *out, int32_t h, int32_t v, const uint8_t *lut)
+{
+    int32_t i;
+    int32_t n = h * v;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        out[i+0] = lut[in[i+0]];
+        out[i+1] = lut[in[i+1]];
+        out[i+2] = lut[in[i+2]];
+        out[i+3] = lut[in[i+3]];
+    }
+    for (; i < n; i++)
+    {
+        out[i] = lut[in[i]];
     }
 
     return;
 }
 
-static img_err_code sobel_edge_detector(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 索贝尔算子可以分解为一行和一列的卷积，先按列计算 vs = a + 2b + c、ds = c - a，a、b、c为上中下三行
+// gx = vs[x+1] - vs[x-1]，gy = ds[x-1] + 2ds[x] + ds[x+1]，结果为 |gx|/2 + |gy|/2，超过255时取255
+// 图像边缘向外扩展1像素，扩展的像素复制最近的像素
+#define SOBEL_BANDS_PER_THREAD 4
+
+static void sobel_vd_c(const uint8_t *a, const uint8_t *b, const uint8_t *c, int16_t *vs, int16_t *ds, int32_t from, int32_t n)
+{
+    int32_t x = 0;
+    for (x = from; x < n; x++)
+    {
+        vs[x] = a[x] + 2 * b[x] + c[x];
+        ds[x] = c[x] - a[x];
+    }
+}
+
+static void sobel_mag_c(const int16_t *vs, const int16_t *ds, uint8_t *out, int32_t from, int32_t n)
+{
+    int32_t x = 0;
+    int32_t gx = 0, gy = 0, sum = 0;
+    for (x = from; x < n; x++)
+    {
+        gx = vs[x+2] - vs[x];
+        gy = ds[x] + 2 * ds[x+1] + ds[x+2];
+        sum = (gx < 0 ? -gx : gx) / 2 + (gy < 0 ? -gy : gy) / 2;
+        out[x] = sum > 255 ? 255 : sum;
+    }
+}
+
+#ifdef IMG_USE_X86_SIMD
+// SSE2 一次处理16个像素，返回已处理的像素数
+IMG_TARGET("sse2")
+static int32_t sobel_vd_sse2(const uint8_t *a, const uint8_t *b, const uint8_t *c, int16_t *vs, int16_t *ds, int32_t n)
 {
-    int32_t he = h + 2;
-    int32_t ve = v + 2;
-    int32_t i, j, k;
-    int32_t m, n;
-    int32_t sum = 0;
-    int32_t opt_size = Sobel.size;
-    int32_t opt_num = Sobel.num;
-    uint8_t *canvas_in = NULL;
-    canvas_in = (uint8_t *)malloc(he*ve);
-    if (canvas_in == NULL)
+    const __m128i zero = _mm_setzero_si128();
+    int32_t x = 0, k = 0;
+
+    for (x = 0; x + 16 <= n; x += 16)
+    {
+        __m128i pa = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i pb = _mm_loadu_si128((const __m128i *)(b + x));
+        __m128i pc = _mm_loadu_si128((const __m128i *)(c + x));
+        for (k = 0; k < 2; k++)
+        {
+            __m128i wa = k ? _mm_unpackhi_epi8(pa, zero) : _mm_unpacklo_epi8(pa, zero);
+            __m128i wb = k ? _mm_unpackhi_epi8(pb, zero) : _mm_unpacklo_epi8(pb, zero);
+            __m128i wc = k ? _mm_unpackhi_epi8(pc, zero) : _mm_unpacklo_epi8(pc, zero);
+            _mm_storeu_si128((__m128i *)(vs + x + k * 8), _mm_add_epi16(_mm_add_epi16(wa, wc), _mm_slli_epi16(wb, 1)));
+            _mm_storeu_si128((__m128i *)(ds + x + k * 8), _mm_sub_epi16(wc, wa));
+        }
+    }
+    return x;
+}
+
+IMG_TARGET("sse2")
+static int32_t sobel_mag_sse2(const int16_t *vs, const int16_t *ds, uint8_t *out, int32_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i m[2];
+    int32_t x = 0, k = 0;
+
+    for (x = 0; x + 16 <= n; x += 16)
+    {
+        for (k = 0; k < 2; k++)
+        {
+            const int16_t *v = vs + x + k * 8;
+            const int16_t *d = ds + x + k * 8;
+            __m128i gx = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(v + 2)), _mm_loadu_si128((const __m128i *)v));
+            __m128i gy = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i *)d), _mm_loadu_si128((const __m128i *)(d + 2))),
+                                       _mm_slli_epi16(_mm_loadu_si128((const __m128i *)(d + 1)), 1));
+            // SSE2 没有 pabsw，用 max(x, -x) 代替
+            gx = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+            gy = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+            m[k] = _mm_add_epi16(_mm_srli_epi16(gx, 1), _mm_srli_epi16(gy, 1));
+        }
+        // packus 饱和到255
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(m[0], m[1]));
+    }
+    return x;
+}
+
+// AVX2 一次处理16个像素
+IMG_TARGET("avx2")
+static int32_t sobel_vd_avx2(const uint8_t *a, const uint8_t *b, const uint8_t *c, int16_t *vs, int16_t *ds, int32_t n)
+{
+    int32_t x = 0;
+
+    for (x = 0; x + 16 <= n; x += 16)
+    {
+        __m256i wa = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + x)));
+        __m256i wb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + x)));
+        __m256i wc = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(c + x)));
+        _mm256_storeu_si256((__m256i *)(vs + x), _mm256_add_epi16(_mm256_add_epi16(wa, wc), _mm256_slli_epi16(wb, 1)));
+        _mm256_storeu_si256((__m256i *)(ds + x), _mm256_sub_epi16(wc, wa));
+    }
+    return x;
+}
+
+IMG_TARGET("avx2")
+static int32_t sobel_mag_avx2(const int16_t *vs, const int16_t *ds, uint8_t *out, int32_t n)
+{
+    int32_t x = 0;
+
+    for (x = 0; x + 16 <= n; x += 16)
+    {
+        const int16_t *v = vs + x;
+        const int16_t *d = ds + x;
+        __m256i gx = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)(v + 2)), _mm256_loadu_si256((const __m256i *)v));
+        __m256i gy = _mm256_add_epi16(_mm256_add_epi16(_mm256_loadu_si256((const __m256i *)d), _mm256_loadu_si256((const __m256i *)(d + 2))),
+                                      _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(d + 1)), 1));
+        __m256i m = _mm256_add_epi16(_mm256_srli_epi16(_mm256_abs_epi16(gx), 1), _mm256_srli_epi16(_mm256_abs_epi16(gy), 1));
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1)));
+    }
+    return x;
+}
+#endif
+
+// 计算一行的边缘，a、b、c为扩展后的上中下三行，长度为 h + 2
+static void sobel_row(const uint8_t *a, const uint8_t *b, const uint8_t *c, int16_t *vs, int16_t *ds, uint8_t *out, int32_t h)
+{
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    uint32_t cpu = img_cpu_flags();
+    if (cpu & IMG_CPU_AVX2)
+    {
+        done = sobel_vd_avx2(a, b, c, vs, ds, h + 2);
+    }
+    else if (cpu & IMG_CPU_SSE2)
+    {
+        done = sobel_vd_sse2(a, b, c, vs, ds, h + 2);
+    }
+#endif
+    sobel_vd_c(a, b, c, vs, ds, done, h + 2);
+
+    // 计算梯度时需要用到右侧的 vs、ds，必须等整行的 vs、ds 都计算完成
+    done = 0;
+#ifdef IMG_USE_X86_SIMD
+    if (cpu & IMG_CPU_AVX2)
+    {
+        done = sobel_mag_avx2(vs, ds, out, h);
+    }
+    else if (cpu & IMG_CPU_SSE2)
+    {
+        done = sobel_mag_sse2(vs, ds, out, h);
+    }
+#endif
+    sobel_mag_c(vs, ds, out, done, h);
+}
+
+typedef struct
+{
+    const uint8_t *in;
+    uint8_t *out;
+    int32_t h;
+    int32_t v;
+    int32_t band_rows; // 每个任务处理的行数
+    uint8_t *scratch; // 每个任务独立的临时内存，大小为 scratch_size
+    int32_t scratch_size;
+} sobel_task;
+
+// 把第 y 行左右各扩展1像素后放入3行的环形缓冲区
+static const uint8_t *sobel_ring_load(const sobel_task *task, uint8_t *ring, int32_t y)
+{
+    uint8_t *row = ring + (y % 3) * (task->h + 2);
+    memcpy(row + 1, task->in + y * task->h, task->h);
+    row[0] = row[1];
+    row[task->h + 1] = row[task->h];
+    return row;
+}
+
+static void sobel_task_run(void *arg, int32_t index)
+{
+    sobel_task *task = (sobel_task *)arg;
+    int32_t h = task->h;
+    int32_t v = task->v;
+    int32_t y0 = index * task->band_rows;
+    int32_t y1 = y0 + task->band_rows > v ? v : y0 + task->band_rows;
+    int16_t *vs = (int16_t *)(task->scratch + (size_t)index * task->scratch_size);
+    int16_t *ds = vs + h + 2;
+    uint8_t *ring = (uint8_t *)(ds + h + 2);
+    const uint8_t *row[3];
+    int32_t y = 0;
+
+    // 上下边缘外的行和边缘行相同
+    row[0] = sobel_ring_load(task, ring, y0 > 0 ? y0 - 1 : y0);
+    row[1] = y0 > 0 ? sobel_ring_load(task, ring, y0) : row[0];
+    for (y = y0; y < y1; y++)
+    {
+        row[2] = y + 1 < v ? sobel_ring_load(task, ring, y + 1) : row[1];
+        sobel_row(row[0], row[1], row[2], vs, ds, task->out + y * h, h);
+        row[0] = row[1];
+        row[1] = row[2];
+    }
+}
+
+static img_err_code sobel_edge_detector(uint8_t *in, uint8_t *out, int32_t h, int32_t v, int32_t threads)
+{
+    sobel_task task;
+    int32_t count = threads > 1 ? threads * SOBEL_BANDS_PER_THREAD : 1;
+
+    count = count > v ? v : count;
+    task.in = in;
+    task.out = out;
+    task.h = h;
+    task.v = v;
+    task.band_rows = (v + count - 1) / count;
+    count = (v + task.band_rows - 1) / task.band_rows;
+    // vs、ds 各 h + 2 个int16，环形缓冲区3行，按32字节对齐
+    task.scratch_size = (((h + 2) * 2 * 2 + (h + 2) * 3) + 31) & ~31;
+    task.scratch = (uint8_t *)malloc((size_t)task.scratch_size * count);
+    if (task.scratch == NULL)
     {
         return IMG_MEM_WRONG;
     }
-    memset(canvas_in, 0, he*ve);
-    memset(out, 0, h*v);
 
-    // 复制原图到中心位置
-    for (i = 0; i < v; i++)
+    img_parallel_for(count, threads, sobel_task_run, &task);
+
+    SAFE_FREE(task.scratch);
+    return IMG_OK;
+}
+
+// 误差扩散的量化，fmt 为 fmt_class 的返回值，调用处都是常量，编译后每种格式各自展开
+static inline uint8_t dither_quantize(int32_t color, int32_t fmt)
+{
+    if (fmt == 0)
     {
-        memcpy(&canvas_in[(i+1)*he+1], &in[i*h], h);
-    }
-
-    // 复制四周边缘的1像素
-    canvas_in[0] = in[0];
-    canvas_in[he-1] = in[(h-1)];
-    canvas_in[(ve-1)*he] = in[(v-1)*h];
-    canvas_in[he*ve-1] = in[(h*v-1)];
-    // for (i = 0; i < h; i++)
-    // {
-    //     canvas_in[i+1] = in[i];
-    // }
-    memcpy(&canvas_in[1], in, h);
-    // for (i = 0; i < h; i++)
-    // {
-    //     canvas_in[he*(ve-1)+i+1] = in[h*(v-1)+i];
-    // }
-    memcpy(&canvas_in[he*(ve-1)+1], &in[h*(v-1)], h);
-    for (i = 0; i < v; i++)
+        // 这里写为>127或>=128，和灰度阈值保持一致
+        return color > 127 ? 255 : 0;
+    }
+    else if (fmt == 1)
     {
-        canvas_in[(i+1)*he] = in[i*h];
+        return web_level[color] * 51;
     }
-    for (i = 0; i < v; i++)
+    // 颜色抖动算法都按照RGB555处理，对于RGB565到RGB555的G通道色彩损失相当于用抖动算法弥补
+    return color & 0xF8;
+}
+
+// 透明色最高字节不为0时不使用透明色
+#define TRANSPARENCE_ENABLE(t) (((t) >> 24) == 0)
+
+// 按16位格式合成一个像素，ARGB1555、BGRA5551使用透明色且颜色等于透明色时为0
+static inline uint16_t rgb888_to_word(int32_t r, int32_t g, int32_t b, fmt_e format, int32_t use_key, uint32_t transparence)
+{
+    if (use_key && (format == FMT_ARGB1555 || format == FMT_BGRA5551) &&
+        (uint32_t)((r << 16) | (g << 8) | b) == transparence)
+    {
+        return 0;
+    }
+    switch (format)
+    {
+    case FMT_RGB565:
+        return (b >> 3) | ((g & 0xFC) << 3) | ((r & 0xF8) << 8);
+    case FMT_BGR565:
+        return ((b & 0xF8) << 8) | ((g & 0xFC) << 3) | (r >> 3);
+    case FMT_ARGB1555:
+        return (b >> 3) | ((g & 0xF8) << 2) | ((r & 0xF8) << 7) | 0x8000;
+    default:
+        return ((b & 0xF8) << 8) | ((g & 0xF8) << 3) | (r >> 2) | 0x0001;
+    }
+}
+
+// 16位格式的转换按格式、字节序、是否使用透明色分别生成，参数都是常量，循环内没有分支，也不需要再交换字节
+static inline void rgb16_write_c(const uint8_t *in, uint8_t *out, int32_t n, fmt_e format, int32_t big_endian,
+                                 int32_t use_key, uint32_t transparence)
+{
+    int32_t i = 0;
+    uint16_t word = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        word = rgb888_to_word(in[i*3+0], in[i*3+1], in[i*3+2], format, use_key, transparence);
+        out[i*2+0] = big_endian ? word >> 8 : word & 0xFF;
+        out[i*2+1] = big_endian ? word & 0xFF : word >> 8;
+    }
+}
+
+#ifdef IMG_USE_X86_SIMD
+// r、g、b为16位的分量，计算方法与 rgb888_to_word 相同
+IMG_TARGET("ssse3")
+static inline __m128i rgb16_word_sse(__m128i r, __m128i g, __m128i b, fmt_e format, int32_t big_endian,
+                                     int32_t use_key, __m128i key_r, __m128i key_g, __m128i key_b)
+{
+    const __m128i mask_f8 = _mm_set1_epi16(0xF8);
+    const __m128i mask_fc = _mm_set1_epi16(0xFC);
+    __m128i w, m;
+
+    switch (format)
+    {
+    case FMT_RGB565:
+        w = _mm_or_si128(_mm_srli_epi16(b, 3), _mm_slli_epi16(_mm_and_si128(g, mask_fc), 3));
+        w = _mm_or_si128(w, _mm_slli_epi16(_mm_and_si128(r, mask_f8), 8));
+        break;
+    case FMT_BGR565:
+        w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask_f8), 8), _mm_slli_epi16(_mm_and_si128(g, mask_fc), 3));
+        w = _mm_or_si128(w, _mm_srli_epi16(r, 3));
+        break;
+    case FMT_ARGB1555:
+        w = _mm_or_si128(_mm_srli_epi16(b, 3), _mm_slli_epi16(_mm_and_si128(g, mask_f8), 2));
+        w = _mm_or_si128(w, _mm_slli_epi16(_mm_and_si128(r, mask_f8), 7));
+        w = _mm_or_si128(w, _mm_set1_epi16((short)0x8000));
+        break;
+    default:
+        w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask_f8), 8), _mm_slli_epi16(_mm_and_si128(g, mask_f8), 3));
+        w = _mm_or_si128(w, _mm_srli_epi16(r, 2));
+        w = _mm_or_si128(w, _mm_set1_epi16(0x0001));
+        break;
+    }
+    if (use_key)
+    {
+        m = _mm_and_si128(_mm_cmpeq_epi16(r, key_r), _mm_and_si128(_mm_cmpeq_epi16(g, key_g), _mm_cmpeq_epi16(b, key_b)));
+        w = _mm_andnot_si128(m, w);
+    }
+    if (big_endian)
+    {
+        w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+    }
+    return w;
+}
+
+// SSSE3 一次处理16个像素，取出r、g、b的方式与灰度化相同
+IMG_TARGET("ssse3")
+static inline int32_t rgb16_write_ssse3(const uint8_t *in, uint8_t *out, int32_t n, fmt_e format, int32_t big_endian,
+                                        int32_t use_key, uint32_t transparence)
+{
+    const __m128i key_r = _mm_set1_epi16((transparence >> 16) & 0xFF);
+    const __m128i key_g = _mm_set1_epi16((transparence >> 8) & 0xFF);
+    const __m128i key_b = _mm_set1_epi16(transparence & 0xFF);
+    __m128i shuf[4][3];
+    int32_t i = 0, k = 0;
+
+    for (k = 0; k < 12; k++)
     {
-        canvas_in[(i+2)*he-1] = in[(i+1)*h-1];
+        shuf[k / 3][k % 3] = _mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]);
     }
 
-    // 卷积
-    for (k = 0; k < opt_num; k++)
+    for (i = 0; i + 16 <= n; i += 16)
     {
-        for (i = 0; i < v; i++)
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i * 3));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i * 3 + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i * 3 + 32));
+        __m128i lo[3], hi[3];
+
+        for (k = 0; k < 3; k++)
         {
-            for (j = 0; j < h; j++)
-            {
-                sum = 0;
-                for (m = 0; m < opt_size; m++)
-                {
-                    for (n = 0; n < opt_size; n++)
-                    {
-                        sum += canvas_in[(i + m) * he + j + n] * Sobel.core[k][m][n];
-                    }
-                }
-                sum /= 2;
-                if (sum < 0) {sum = -sum;}
-                sum += out[i * h + j];
-                if (sum > 255) {sum = 255;}
-                out[i * h + j] = sum;
-            }
+            lo[k] = _mm_or_si128(_mm_shuffle_epi8(a, shuf[0][k]), _mm_shuffle_epi8(b, shuf[1][k]));
+            hi[k] = _mm_or_si128(_mm_shuffle_epi8(b, shuf[2][k]), _mm_shuffle_epi8(c, shuf[3][k]));
         }
+        _mm_storeu_si128((__m128i *)(out + i * 2),
+                         rgb16_word_sse(lo[0], lo[1], lo[2], format, big_endian, use_key, key_r, key_g, key_b));
+        _mm_storeu_si128((__m128i *)(out + i * 2 + 16),
+                         rgb16_word_sse(hi[0], hi[1], hi[2], format, big_endian, use_key, key_r, key_g, key_b));
     }
+    return i;
+}
 
-    SAFE_FREE(canvas_in);
-    return IMG_OK;
+IMG_TARGET("avx2")
+static inline __m256i rgb16_word_avx2(__m256i r, __m256i g, __m256i b, fmt_e format, int32_t big_endian,
+                                      int32_t use_key, __m256i key_r, __m256i key_g, __m256i key_b)
+{
+    const __m256i mask_f8 = _mm256_set1_epi16(0xF8);
+    const __m256i mask_fc = _mm256_set1_epi16(0xFC);
+    __m256i w, m;
+
+    switch (format)
+    {
+    case FMT_RGB565:
+        w = _mm256_or_si256(_mm256_srli_epi16(b, 3), _mm256_slli_epi16(_mm256_and_si256(g, mask_fc), 3));
+        w = _mm256_or_si256(w, _mm256_slli_epi16(_mm256_and_si256(r, mask_f8), 8));
+        break;
+    case FMT_BGR565:
+        w = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, mask_f8), 8), _mm256_slli_epi16(_mm256_and_si256(g, mask_fc), 3));
+        w = _mm256_or_si256(w, _mm256_srli_epi16(r, 3));
+        break;
+    case FMT_ARGB1555:
+        w = _mm256_or_si256(_mm256_srli_epi16(b, 3), _mm256_slli_epi16(_mm256_and_si256(g, mask_f8), 2));
+        w = _mm256_or_si256(w, _mm256_slli_epi16(_mm256_and_si256(r, mask_f8), 7));
+        w = _mm256_or_si256(w, _mm256_set1_epi16((short)0x8000));
+        break;
+    default:
+        w = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, mask_f8), 8), _mm256_slli_epi16(_mm256_and_si256(g, mask_f8), 3));
+        w = _mm256_or_si256(w, _mm256_srli_epi16(r, 2));
+        w = _mm256_or_si256(w, _mm256_set1_epi16(0x0001));
+        break;
+    }
+    if (use_key)
+    {
+        m = _mm256_and_si256(_mm256_cmpeq_epi16(r, key_r), _mm256_and_si256(_mm256_cmpeq_epi16(g, key_g), _mm256_cmpeq_epi16(b, key_b)));
+        w = _mm256_andnot_si256(m, w);
+    }
+    if (big_endian)
+    {
+        w = _mm256_or_si256(_mm256_slli_epi16(w, 8), _mm256_srli_epi16(w, 8));
+    }
+    return w;
 }
 
-static uint8_t dither_limit_denominator_16(uint8_t in, int8_t err, int32_t numerator)
+// AVX2 一次处理32个像素，读取方式与 rgb8882gray_avx2 相同，lo为像素0-7、16-23，hi为像素8-15、24-31
+IMG_TARGET("avx2")
+static inline int32_t rgb16_write_avx2(const uint8_t *in, uint8_t *out, int32_t n, fmt_e format, int32_t big_endian,
+                                       int32_t use_key, uint32_t transparence)
+{
+    const __m256i key_r = _mm256_set1_epi16((transparence >> 16) & 0xFF);
+    const __m256i key_g = _mm256_set1_epi16((transparence >> 8) & 0xFF);
+    const __m256i key_b = _mm256_set1_epi16(transparence & 0xFF);
+    __m256i shuf[4][3];
+    int32_t i = 0, k = 0;
+
+    for (k = 0; k < 12; k++)
+    {
+        shuf[k / 3][k % 3] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]));
+    }
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        const uint8_t *s = in + i * 3;
+        __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s +  0))),
+                                            _mm_loadu_si128((const __m128i *)(s + 48)), 1);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 16))),
+                                            _mm_loadu_si128((const __m128i *)(s + 64)), 1);
+        __m256i c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 32))),
+                                            _mm_loadu_si128((const __m128i *)(s + 80)), 1);
+        __m256i lo[3], hi[3];
+
+        for (k = 0; k < 3; k++)
+        {
+            lo[k] = _mm256_or_si256(_mm256_shuffle_epi8(a, shuf[0][k]), _mm256_shuffle_epi8(b, shuf[1][k]));
+            hi[k] = _mm256_or_si256(_mm256_shuffle_epi8(b, shuf[2][k]), _mm256_shuffle_epi8(c, shuf[3][k]));
+        }
+        lo[0] = rgb16_word_avx2(lo[0], lo[1], lo[2], format, big_endian, use_key, key_r, key_g, key_b);
+        hi[0] = rgb16_word_avx2(hi[0], hi[1], hi[2], format, big_endian, use_key, key_r, key_g, key_b);
+        _mm256_storeu_si256((__m256i *)(out + i * 2), _mm256_permute2x128_si256(lo[0], hi[0], 0x20));
+        _mm256_storeu_si256((__m256i *)(out + i * 2 + 32), _mm256_permute2x128_si256(lo[0], hi[0], 0x31));
+    }
+    return i;
+}
+
+// 生成一个16位格式的转换函数，根据CPU选择SIMD版本，剩余不足一组的像素用C语言版本处理
+#define RGB16_KERNEL(name, format, big_endian, use_key) \
+IMG_TARGET("ssse3") \
+static int32_t name##_ssse3(const uint8_t *in, uint8_t *out, int32_t n, uint32_t transparence) \
+{ \
+    return rgb16_write_ssse3(in, out, n, format, big_endian, use_key, transparence); \
+} \
+IMG_TARGET("avx2") \
+static int32_t name##_avx2(const uint8_t *in, uint8_t *out, int32_t n, uint32_t transparence) \
+{ \
+    return rgb16_write_avx2(in, out, n, format, big_endian, use_key, transparence); \
+} \
+static void name(const uint8_t *in, uint8_t *out, int32_t n, uint32_t transparence) \
+{ \
+    int32_t done = 0; \
+    uint32_t cpu = img_cpu_flags(); \
+    if (cpu & IMG_CPU_AVX2) \
+    { \
+        done = name##_avx2(in, out, n, transparence); \
+    } \
+    else if (cpu & IMG_CPU_SSSE3) \
+    { \
+        done = name##_ssse3(in, out, n, transparence); \
+    } \
+    rgb16_write_c(in + done * 3, out + done * 2, n - done, format, big_endian, use_key, transparence); \
+}
+#else
+#define RGB16_KERNEL(name, format, big_endian, use_key) \
+static void name(const uint8_t *in, uint8_t *out, int32_t n, uint32_t transparence) \
+{ \
+    rgb16_write_c(in, out, n, format, big_endian, use_key, transparence); \
+}
+#endif
+
+RGB16_KERNEL(rgb888_to_rgb565_le, FMT_RGB565, 0, 0)
+RGB16_KERNEL(rgb888_to_rgb565_be, FMT_RGB565, 1, 0)
+RGB16_KERNEL(rgb888_to_bgr565_le, FMT_BGR565, 0, 0)
+RGB16_KERNEL(rgb888_to_bgr565_be, FMT_BGR565, 1, 0)
+RGB16_KERNEL(rgb888_to_argb1555_le, FMT_ARGB1555, 0, 0)
+RGB16_KERNEL(rgb888_to_argb1555_be, FMT_ARGB1555, 1, 0)
+RGB16_KERNEL(rgb888_to_argb1555_le_key, FMT_ARGB1555, 0, 1)
+RGB16_KERNEL(rgb888_to_argb1555_be_key, FMT_ARGB1555, 1, 1)
+RGB16_KERNEL(rgb888_to_bgra5551_le, FMT_BGRA5551, 0, 0)
+RGB16_KERNEL(rgb888_to_bgra5551_be, FMT_BGRA5551, 1, 0)
+RGB16_KERNEL(rgb888_to_bgra5551_le_key, FMT_BGRA5551, 0, 1)
+RGB16_KERNEL(rgb888_to_bgra5551_be_key, FMT_BGRA5551, 1, 1)
+
+// 下标依次为 格式 - FMT_RGB565、是否大端、是否使用透明色，565格式没有透明色
+static const convert_rgb16 convert_rgb16_list[4][2][2] = {
+    {{rgb888_to_rgb565_le, rgb888_to_rgb565_le}, {rgb888_to_rgb565_be, rgb888_to_rgb565_be}},
+    {{rgb888_to_bgr565_le, rgb888_to_bgr565_le}, {rgb888_to_bgr565_be, rgb888_to_bgr565_be}},
+    {{rgb888_to_argb1555_le, rgb888_to_argb1555_le_key}, {rgb888_to_argb1555_be, rgb888_to_argb1555_be_key}},
+    {{rgb888_to_bgra5551_le, rgb888_to_bgra5551_le_key}, {rgb888_to_bgra5551_be, rgb888_to_bgra5551_be_key}},
+};
+
+// 误差扩散直接输出16位格式时的参数
+typedef struct
+{
+    uint32_t transparence;
+    int32_t use_key;
+    int32_t is_big_endian;
+} dither_pack;
+
+static inline uint8_t dither_limit_denominator_16(uint8_t in, int8_t err, int32_t numerator)
 {
     int32_t out = in + err * numerator / 16;
     if (out > 255) {out = 255;}
@@ -452,302 +1097,711 @@ static uint8_t dither_limit_denominator_16(uint8_t in, int8_t err, int32_t numer
     return (uint8_t)out;
 }
 
-static void dither_color_space_bitmap(uint8_t *in, uint8_t *out, int8_t *err)
+// 画布行保存已经累加过误差的像素值，两端各多留一个像素，避免判断边界
+// 每次扩散都按1/16截断并限制在0~255，和逐行处理整幅画布时完全一致
+// 原来的彩色实现向下一行扩散时整体错开了一个字节，第c个分量的误差加到前一个字节上，这里保持相同的输出，
+// 所以画布行前面还要多留一个字节
+// 处理第i行的第x0到x1-1个像素，row_cur为本行的画布行，row_next为下一行的画布行
+// format 为16位格式时，每个像素量化之后直接按字节序写出最终的16位数据，否则按 channels 写出量化后的颜色
+static inline void floyd_steinberg_pixels(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                          int32_t x0, int32_t x1, int32_t channels, int32_t fmt, fmt_e format,
+                                          const dither_pack *pack)
 {
-    // 这里写为>127或>=128，避免err溢出
-    *out = *in > 127 ? 255 : 0;
-    *err = *in - *out;
-    return;
+    int32_t j = 0, c = 0, k = 0;
+    int8_t err[3] = {0};
+    uint8_t q[3] = {0};
+    uint16_t word = 0;
+
+    // 扩散矩阵
+    // ...  ...  src  7/16  ...
+    // ...  3/16 5/16 1/16  ...
+    for (j = x0; j < x1; j++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            k = (j + 1) * channels + c;
+            q[c] = dither_quantize(row_cur[k], fmt);
+            err[c] = (int8_t)(row_cur[k] - q[c]);
+            row_cur[k + channels] = dither_limit_denominator_16(row_cur[k + channels], err[c], 7);
+        }
+        k = channels > 1 ? j * channels - 1 : j * channels;
+        for (c = 0; c < channels; c++)
+        {
+            row_next[k + c] = dither_limit_denominator_16(row_next[k + c], err[c], 3);
+            row_next[k + channels + c] = dither_limit_denominator_16(row_next[k + channels + c], err[c], 5);
+            row_next[k + channels * 2 + c] = dither_limit_denominator_16(row_next[k + channels * 2 + c], err[c], 1);
+        }
+        if (format >= FMT_RGB565)
+        {
+            word = rgb888_to_word(q[0], q[1], q[2], format, pack->use_key, pack->transparence);
+            out[j * 2 + 0] = pack->is_big_endian ? word >> 8 : word & 0xFF;
+            out[j * 2 + 1] = pack->is_big_endian ? word & 0xFF : word >> 8;
+            continue;
+        }
+        for (c = 0; c < channels; c++)
+        {
+            out[j * channels + c] = q[c];
+        }
+    }
+}
+
+static void floyd_steinberg_pixels_bitmap(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                          int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 1, 0, FMT_BITMAP_RL, pack);
+}
+
+static void floyd_steinberg_pixels_web(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                       int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 1, FMT_WEB, pack);
+}
+
+static void floyd_steinberg_pixels_rgb555(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                          int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 2, FMT_WEB, pack);
+}
+
+static void floyd_steinberg_pixels_rgb565(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                          int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 2, FMT_RGB565, pack);
+}
+
+static void floyd_steinberg_pixels_bgr565(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                          int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 2, FMT_BGR565, pack);
+}
+
+static void floyd_steinberg_pixels_argb1555(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                            int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 2, FMT_ARGB1555, pack);
+}
+
+static void floyd_steinberg_pixels_bgra5551(uint8_t *out, uint8_t *row_cur, uint8_t *row_next,
+                                            int32_t x0, int32_t x1, const dither_pack *pack)
+{
+    floyd_steinberg_pixels(out, row_cur, row_next, x0, x1, 3, 2, FMT_BGRA5551, pack);
+}
+
+// 每次同步的像素数
+#define DITHER_CHUNK 64
+
+typedef void(*dither_pixels)(uint8_t *out, uint8_t *row_cur, uint8_t *row_next, int32_t x0, int32_t x1,
+                             const dither_pack *pack);
+
+typedef struct
+{
+    const uint8_t *in;
+    uint8_t *out;
+    int32_t h;
+    int32_t v;
+    int32_t channels;
+    int32_t out_line; // 输出每行的字节数
+    dither_pixels func;
+    const dither_pack *pack;
+    uint8_t *rows; // 画布行环形缓冲区，第i行使用第 i % row_count 行
+    int32_t row_count;
+    int32_t row_size; // 每个画布行的字节数，包括前面多留的一个字节
+    int32_t next_row; // 下一个未领取的行
+    int32_t *done; // 每一行已经处理完的像素数
+} dither_task;
+
+// 波前并行：第i行的像素j会收到第i-1行的像素j-1到j+2扩散的误差（彩色错开一个字节，最右边多一个像素），
+// 第i行处理像素j时还会向像素j+1扩散，而像素j+1还会收到第i-1行的像素j+3扩散的误差，
+// 所以第i-1行处理完像素j+3之后第i行才能处理像素j，
+// 这样每个像素收到误差的顺序和逐行处理时完全一致，结果也完全相同
+// 第i行开始前把原图第i+1行复制到下一个画布行，这个画布行上一次被第 i+1-row_count 行使用，需要等这一行处理完
+// 行按顺序领取，等待的总是更靠前的、正在处理的行，线程数少于任务数时也不会死锁
+static void dither_task_run(void *arg, int32_t index)
+{
+    dither_task *task = (dither_task *)arg;
+    int32_t i = 0, x0 = 0, x1 = 0, need = 0;
+    uint8_t *row_cur = NULL;
+    uint8_t *row_next = NULL;
+    size_t line = (size_t)task->h * task->channels;
+
+    (void)index;
+    while (1)
+    {
+        i = img_atomic_fetch_inc(&task->next_row);
+        if (i >= task->v)
+        {
+            break;
+        }
+        while (i + 1 >= task->row_count && img_atomic_load(&task->done[i + 1 - task->row_count]) < task->h)
+        {
+            img_yield();
+        }
+        row_cur = task->rows + (size_t)(i % task->row_count) * task->row_size + 1;
+        row_next = task->rows + (size_t)((i + 1) % task->row_count) * task->row_size + 1;
+        if (i + 1 < task->v)
+        {
+            memcpy(row_next + task->channels, task->in + (i + 1) * line, line);
+        }
+        for (x0 = 0; x0 < task->h; x0 = x1)
+        {
+            x1 = x0 + DITHER_CHUNK < task->h ? x0 + DITHER_CHUNK : task->h;
+            need = x1 + 3 < task->h ? x1 + 3 : task->h;
+            while (i > 0 && img_atomic_load(&task->done[i-1]) < need)
+            {
+                img_yield();
+            }
+            task->func(task->out + (size_t)i * task->out_line, row_cur, row_next, x0, x1, task->pack);
+            img_atomic_store(&task->done[i], x1);
+        }
+    }
+}
+
+// 参考资料
+// https://blog.csdn.net/qq_42676511/article/details/120626723
+// https://github.com/Rudranil-Sarkar/Floyd-Steinberg-dithering-algo/blob/master/bitmap.cpp
+// out_bpp 为输出每个像素的字节数，pack 为输出16位格式时的参数，其他情况为NULL
+static img_err_code floyd_steinberg_dither(uint8_t *in, uint8_t *out, int32_t h, int32_t v, int32_t channels,
+                                           int32_t out_bpp, dither_pixels func, const dither_pack *pack, int32_t threads)
+{
+    dither_task task;
+
+    threads = threads > v ? v : threads;
+    memset(&task, 0, sizeof(task));
+    // 同时处理的行最多为线程数，每行还要向下一行扩散误差
+    task.row_count = threads + 1;
+    task.row_size = (h + 2) * channels + 1;
+    task.rows = (uint8_t *)malloc((size_t)task.row_count * task.row_size);
+    task.done = (int32_t *)malloc(v * sizeof(int32_t));
+    if (task.rows == NULL || task.done == NULL)
+    {
+        SAFE_FREE(task.rows);
+        SAFE_FREE(task.done);
+        return IMG_MEM_WRONG;
+    }
+    memset(task.rows, 0, (size_t)task.row_count * task.row_size);
+    memset(task.done, 0, v * sizeof(int32_t));
+    // 图像边缘向外扩展1像素，第0行先复制到画布行中，后面的行由上一行开始时复制
+    memcpy(task.rows + 1 + channels, in, (size_t)h * channels);
+
+    task.in = in;
+    task.out = out;
+    task.h = h;
+    task.v = v;
+    task.channels = channels;
+    task.out_line = h * out_bpp;
+    task.func = func;
+    task.pack = pack;
+    img_parallel_for(threads, threads, dither_task_run, &task);
+
+    SAFE_FREE(task.rows);
+    SAFE_FREE(task.done);
+    return IMG_OK;
+}
+
+// 有序抖动：每个像素按所在位置从阈值矩阵中取一个阈值，结果只和像素自身有关，可以任意并行，相邻帧之间图案也保持稳定
+// 阈值取值0~254，位图灰度大于阈值时为白色；彩色图像按阈值在量化间隔内加上一个偏移后向下取整
+#define ORDERED_BANDS_PER_THREAD 4
+
+// 32x32 蓝噪声阈值矩阵，用 void-and-cluster 算法生成（高斯核 sigma=1.5），取值为 (2*rank+1)*255/2048
+static const uint8_t blue_noise[32][32] = {
+    {195,  84,  17, 254,  73, 134, 190, 152,  12, 251,  39, 126,  14, 240,  56, 212,
+     154,  27, 221,  16, 239,  45, 151,  33,  94, 147, 107,  81, 214, 120, 236,  33},
+    {148, 231, 124, 201,  34, 224,  59, 113, 180,  97, 192, 210, 153,  75, 168, 134,
+      43, 109, 171,  83, 159, 101, 229, 123, 219,  51, 249, 156,  10, 176, 140,  67},
+    {  3, 173,  62, 106, 167,  93,  23, 232,  46, 135,  23,  62, 115,  35, 222,  86,
+     192, 237,  54, 203, 130,   5, 196,  23,  74, 186,  27,  70, 231,  49,  97, 210},
+    {112,  46, 215,  20, 140, 185, 209, 147,  75, 163, 226,  90, 243, 178,   2, 125,
+      20,  74, 142,  30, 246,  63, 168, 143, 234, 129, 171, 206, 115, 194,  22, 248},
+    {187,  92, 155, 244,  69,  43, 122,   0, 247, 105, 183,  12, 144, 204,  96, 250,
+     152, 218, 177, 117,  91, 214, 110,  47,  89,   1,  99,  40, 142,  84, 161, 130},
+    { 71, 224,   9, 118, 197, 234,  86, 173,  60,  32, 217,  56, 123,  39,  67, 166,
+      51, 101,  11, 229,  41, 184,  19, 251, 191, 217, 161, 245,  15, 215,  59,  31},
+    {200, 136,  40, 172,  98,  17, 157, 222, 193, 131, 152,  85, 170, 236, 110, 195,
+      29, 205, 134,  68, 160, 125,  79, 150,  66, 118,  53,  76, 187, 107, 239, 174},
+    {104, 250,  78, 209,  58, 138,  35, 110,  79,   8, 244, 187,  25, 211,   7, 131,
+     233,  83, 182, 243,  26, 202, 226,  10, 174,  29, 147, 223, 126,  35, 149,  12},
+    { 51, 163,  24, 127, 226, 188, 253,  55, 204, 119,  44, 102,  72, 141,  87, 159,
+      60, 114,   3, 143,  94,  56, 104, 133, 241, 206, 103,   6, 179,  63, 228,  85},
+    {144, 220, 182, 107,   7,  87, 166,  18, 146, 230, 160, 198, 225,  49, 254, 186,
+      36, 215, 169,  47, 213, 156, 181,  34,  87,  48, 189, 253,  91, 160, 203, 122},
+    {  1,  72,  42, 244, 158,  65, 123, 214,  95,  65,  22, 128,  10, 172, 102,  19,
+     124, 239,  70, 108, 251,  13,  69, 232, 165, 122,  73,  21, 137,  45,  24, 237},
+    {172, 210, 139,  94, 197,  44, 240, 175,  38, 183, 248,  86, 153, 216,  69, 200,
+     150,  92, 189,  28, 132, 194, 116, 205,   3, 146, 211, 171, 221, 116, 193,  96},
+    { 57, 113,  26, 221,  16, 149,  81,   2, 138, 114, 207,  30, 109,  42, 132, 228,
+      52,  15, 158, 226,  82,  44, 150,  90,  57, 246,  38,  98,  61, 242,  75, 148},
+    {252, 188,  80, 167, 121, 231, 108, 200, 227,  77,  52, 167, 196, 240,   0,  82,
+     182, 111, 210,  60, 173, 235,  17, 218, 109, 180, 126,   9, 158,  31, 179,  15},
+    { 37, 128, 228,  48,  68, 181,  32,  59, 158,  14, 243, 125,  63,  95, 176, 143,
+     246,  37, 139,   5, 124, 100, 190, 162,  24,  79, 230, 195, 217, 135, 107, 207},
+    {163, 100,   8, 139, 212,  96, 252, 129, 177,  98, 147,  22, 223, 155,  30, 119,
+      66, 219,  93, 199, 249,  33,  70, 135, 241,  43, 143,  65,  90,  47, 233,  78},
+    { 55, 193, 245, 174,  27, 153,   9, 219,  43, 194, 216,  84, 185,  49, 235, 203,
+      10, 155,  54, 165,  76, 151, 224,  54, 117, 202, 170,  21, 120, 191,   5, 144},
+    {230,  32,  89,  64, 118, 199,  70,  88, 114,  27,  64, 117,   7, 133, 101,  80,
+     186, 105, 225,  19, 115, 184,  12, 208,  85,   1, 103, 224, 153, 247, 172, 114},
+    {213, 130, 157, 222,  48, 239, 137, 166, 232, 142, 249, 163, 207, 228, 170,  35,
+     253, 129,  41, 197, 242,  50, 104, 168, 140, 253, 185,  57,  32,  83,  62,  20},
+    {180,  73,   4, 178, 102,  16, 184,  54,   3, 197,  46,  95,  25,  74,  56, 148,
+      18, 177,  69, 144,  88, 133,  28, 234,  63,  38, 130,  95, 209, 137, 199,  96},
+    { 46, 113, 254, 141, 211,  38, 123, 216, 105,  81, 178, 127, 156, 190, 240, 121,
+     212,  94, 234,  11, 169, 220, 189,  80, 152, 196,  17, 173, 238,  11, 160, 242},
+    {145, 201,  23,  58,  80, 162, 246,  71, 140, 223,  14, 235,  41, 109,   1,  77,
+     162,  53, 116, 201,  36,  61, 120,   8, 211, 110, 225,  71, 120,  53, 111,  28},
+    {169,  85, 232, 132, 194,  98,  19, 201,  34, 159,  61, 200,  87, 218, 141, 195,
+      21, 222, 149,  81, 251, 101, 162, 238,  52,  91, 145,  40, 165, 204,  82, 220},
+    {  9, 106, 176,  34, 225, 148,  52, 175, 119, 252,  99, 133,  22, 175,  59, 249,
+     104,  42, 183,   5, 136, 192,  26, 131, 176,  29, 250, 187,   4, 230, 134,  64},
+    {248,  47, 124,  75,   0, 112, 213,  91,   6, 189,  48, 154, 241, 118,  31,  82,
+     166, 126, 237,  65, 215,  45,  88, 204,  67, 218, 128,  78, 100, 154,  36, 185},
+    {206, 156, 217, 182, 237, 164,  64, 227, 136,  77, 207,  11,  74, 192, 142, 229,
+     202,  25,  93, 168, 108, 150, 245,   0, 157, 106,  18, 199,  58, 242, 119,  89},
+    {137,  66,  20,  97,  44, 129,  26, 184,  40, 238, 115, 174, 223,  41,  99,   4,
+      66, 155,  50, 221,  15, 179,  73, 117, 231,  49, 171, 139, 214,  25, 165,  13},
+    { 39, 112, 245, 145, 205,  83, 250, 103, 146, 164,  29,  62, 106, 159, 216, 178,
+     116, 247, 135, 188,  39, 128, 202,  31, 186,  95, 247,  37, 113,  76, 188, 235},
+    {203, 167, 191,  57,  16, 154, 193,  13,  60,  90, 212, 132, 248,  18,  55,  86,
+     208,  13, 102,  76, 238,  92,  55, 223, 145,  77,  14, 191, 151, 227,  51, 100},
+    { 72,   7,  88, 121, 233,  68, 111, 220, 177, 236,   2, 196,  78, 151, 233, 138,
+      37, 161, 229,  28, 206, 164, 136,  21, 169, 121, 213,  68,  97,   2, 127, 149},
+    {243, 219, 138,  36, 209, 170,  45, 127,  33, 141, 108,  50, 175,  31, 122, 198,
+      72, 181,  53, 146, 112,   8, 254, 105,  61, 236,  42, 159, 244, 180, 208,  24},
+    {111,  50, 181, 157,  99,   4, 241,  84, 205,  71, 161, 227,  92, 190, 103,   6,
+     252,  93, 125, 198,  67, 183,  79, 208, 179,   6, 198, 131,  30,  58,  89, 164},
+};
+
+// 生成阈值矩阵，返回矩阵边长
+static int32_t ordered_tile_init(dither_e mode, uint8_t *tile)
+{
+    // 2x2 Bayer 矩阵，M(2n) = 4 * M(n) + M(2)，坐标的低位对应结果的高位
+    static const uint8_t bayer_2[2][2] = {{0, 2}, {3, 1}};
+    int32_t bits = 0, n = 0;
+    int32_t x = 0, y = 0, i = 0, m = 0;
+
+    if (mode == DITHER_BLUE_NOISE)
+    {
+        memcpy(tile, blue_noise, sizeof(blue_noise));
+        return 32;
+    }
+    bits = mode == DITHER_BAYER_2 ? 1 : (mode == DITHER_BAYER_4 ? 2 : 3);
+    n = 1 << bits;
+    for (y = 0; y < n; y++)
+    {
+        for (x = 0; x < n; x++)
+        {
+            m = 0;
+            for (i = 0; i < bits; i++)
+            {
+                m |= bayer_2[(y >> i) & 1][(x >> i) & 1] << (2 * (bits - 1 - i));
+            }
+            tile[y * n + x] = (2 * m + 1) * 255 / (2 * n * n);
+        }
+    }
+    return n;
 }
 
-static void dither_color_space_web(pixel_rgb888 *in, pixel_rgb888 *out, pixel_rgb_err *err)
+static void ordered_row_bitmap_c(const uint8_t *in, const uint8_t *thr, uint8_t *out, int32_t from, int32_t n)
 {
-    static uint8_t color_table[6] = {0x00, 0x33, 0x66, 0x99, 0xcc, 0xff};
     int32_t i = 0;
-    int32_t color_id = 0;
-    uint8_t color = 0;
+    for (i = from; i < n; i++)
+    {
+        out[i] = in[i] > thr[i] ? 255 : 0;
+    }
+}
 
-    for (i = 0; i < 3; i++)
+// web颜色每个分量6级，间隔51
+static void ordered_row_web_c(const uint8_t *in, const uint8_t *thr, uint8_t *out, int32_t from, int32_t n)
+{
+    int32_t i = 0, id = 0;
+    for (i = from; i < n; i++)
     {
-        // 0,26,77,128,179,229,255 量化相对而言效果略好
-        // 0,42,85,128,170,213,255 量化最简单直接
-        color = (*in)[i];
-        color_id = color > 229 ? 5 : (color + 26) / 51;
-        (*out)[i] = color_table[color_id];
-        (*err)[i] = (*in)[i] - (*out)[i];
+        id = (in[i] + thr[i]) / 51;
+        out[i] = (id > 5 ? 5 : id) * 51;
     }
-    return;
 }
 
-// 颜色抖动算法都按照RGB555处理，对于RGB565到RGB555的G通道色彩损失相当于用抖动算法弥补
-static void dither_color_space_rgb555(pixel_rgb888 *in, pixel_rgb888 *out, pixel_rgb_err *err)
+// 和误差扩散一样按rgb555处理
+static void ordered_row_rgb555_c(const uint8_t *in, const uint8_t *thr, uint8_t *out, int32_t from, int32_t n)
+{
+    int32_t i = 0, c = 0;
+    for (i = from; i < n; i++)
+    {
+        c = in[i] + thr[i];
+        out[i] = (c > 255 ? 255 : c) & 0xF8;
+    }
+}
+
+#ifdef IMG_USE_X86_SIMD
+// SSE2 一次处理16字节，返回已处理的字节数
+IMG_TARGET("sse2")
+static int32_t ordered_row_sse2(const uint8_t *in, const uint8_t *thr, uint8_t *out, int32_t n, int32_t fmt)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask_555 = _mm_set1_epi8((char)0xF8);
+    const __m128i div_51 = _mm_set1_epi16(1286); // 0~305 范围内 x * 1286 >> 16 等于 x / 51
+    const __m128i max_id = _mm_set1_epi16(5);
+    const __m128i mul_51 = _mm_set1_epi16(51);
+    int32_t i = 0;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i t = _mm_loadu_si128((const __m128i *)(thr + i));
+        __m128i lo, hi;
+
+        if (fmt == 0)
+        {
+            // p <= t 时饱和减法结果为0
+            p = _mm_cmpeq_epi8(_mm_subs_epu8(p, t), zero);
+            p = _mm_xor_si128(p, _mm_cmpeq_epi8(zero, zero));
+        }
+        else if (fmt == 1)
+        {
+            lo = _mm_add_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(t, zero));
+            hi = _mm_add_epi16(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(t, zero));
+            lo = _mm_mullo_epi16(_mm_min_epi16(_mm_mulhi_epu16(lo, div_51), max_id), mul_51);
+            hi = _mm_mullo_epi16(_mm_min_epi16(_mm_mulhi_epu16(hi, div_51), max_id), mul_51);
+            p = _mm_packus_epi16(lo, hi);
+        }
+        else
+        {
+            p = _mm_and_si128(_mm_adds_epu8(p, t), mask_555);
+        }
+        _mm_storeu_si128((__m128i *)(out + i), p);
+    }
+    return i;
+}
+#endif
+
+typedef struct
+{
+    const uint8_t *in;
+    uint8_t *out;
+    int32_t width; // 每行的字节数
+    int32_t v;
+    int32_t fmt; // fmt_class 的返回值
+    int32_t tile_size;
+    const uint8_t *thr; // 阈值矩阵每一行展开为整行的阈值或偏移，共 tile_size 行
+    int32_t band_rows;
+} ordered_task;
+
+static void ordered_task_run(void *arg, int32_t index)
+{
+    ordered_task *task = (ordered_task *)arg;
+    int32_t y0 = index * task->band_rows;
+    int32_t y1 = y0 + task->band_rows > task->v ? task->v : y0 + task->band_rows;
+    int32_t y = 0, done = 0;
+    const uint8_t *in = NULL;
+    const uint8_t *thr = NULL;
+    uint8_t *out = NULL;
+
+    for (y = y0; y < y1; y++)
+    {
+        in = task->in + (size_t)y * task->width;
+        out = task->out + (size_t)y * task->width;
+        thr = task->thr + (size_t)(y % task->tile_size) * task->width;
+        done = 0;
+#ifdef IMG_USE_X86_SIMD
+        if (img_cpu_flags() & IMG_CPU_SSE2)
+        {
+            done = ordered_row_sse2(in, thr, out, task->width, task->fmt);
+        }
+#endif
+        if (task->fmt == 0)
+        {
+            ordered_row_bitmap_c(in, thr, out, done, task->width);
+        }
+        else if (task->fmt == 1)
+        {
+            ordered_row_web_c(in, thr, out, done, task->width);
+        }
+        else
+        {
+            ordered_row_rgb555_c(in, thr, out, done, task->width);
+        }
+    }
+}
+
+// channels 为1时输入输出为灰度图像，为3时为rgb888
+static img_err_code ordered_dither(uint8_t *in, uint8_t *out, int32_t h, int32_t v, int32_t channels, int32_t fmt,
+                                   dither_e mode, int32_t threads)
+{
+    uint8_t tile[32 * 32];
+    uint8_t *thr = NULL;
+    ordered_task task;
+    int32_t n = 0, x = 0, y = 0, c = 0, t = 0;
+    int32_t count = threads > 1 ? threads * ORDERED_BANDS_PER_THREAD : 1;
+
+    n = ordered_tile_init(mode, tile);
+    thr = (uint8_t *)malloc((size_t)n * h * channels);
+    if (thr == NULL)
+    {
+        return IMG_MEM_WRONG;
+    }
+    // 位图直接使用阈值，彩色图像转换为量化间隔内的偏移
+    for (y = 0; y < n; y++)
+    {
+        for (x = 0; x < h; x++)
+        {
+            t = tile[y * n + x % n];
+            t = fmt == 0 ? t : (fmt == 1 ? t * 51 / 255 : t * 8 / 255);
+            for (c = 0; c < channels; c++)
+            {
+                thr[((size_t)y * h + x) * channels + c] = t;
+            }
+        }
+    }
+
+    count = count > v ? v : count;
+    task.in = in;
+    task.out = out;
+    task.width = h * channels;
+    task.v = v;
+    task.fmt = fmt;
+    task.tile_size = n;
+    task.thr = thr;
+    task.band_rows = (v + count - 1) / count;
+    count = (v + task.band_rows - 1) / task.band_rows;
+    img_parallel_for(count, threads, ordered_task_run, &task);
+
+    SAFE_FREE(thr);
+    return IMG_OK;
+}
+
+static void color_invert(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
 {
-    int32_t i = 0;
-    for (i = 0; i < 3; i++)
+    int32_t i;
+    for (i = 0; i < h*v; i++)
     {
-        (*out)[i] = (*in)[i] & 0xF8;
-        (*err)[i] = (*in)[i] & 0x07;
+        out[i] = ~in[i];
     }
     return;
 }
 
-static img_err_code floyd_steinberg_dither_gray8(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 不抖动、不做边缘识别时，bitmap的每个像素只和自身有关，逐行完成灰度、亮度对比度、反色，每8行打包一次
+// 只需要8行的临时内存，不再经过 stage_buf
+static img_err_code img_enc_bitmap_row(_img_enc_ctx *ctx, uint8_t *out)
 {
-    // 参考资料
-    // https://blog.csdn.net/qq_42676511/article/details/120626723
-    // https://github.com/Rudranil-Sarkar/Floyd-Steinberg-dithering-algo/blob/master/bitmap.cpp
-
-    int32_t he = h + 2;
-    int32_t ve = v + 2;
-    int32_t i, j;
+    int32_t h = ctx->in_buf.width;
+    int32_t v = ctx->in_buf.height;
+    int32_t y = 0;
+    int32_t i = 0;
+    int32_t rows = 0;
+    uint8_t *line = NULL;
+    uint8_t lut[256];
 
-    uint8_t *canvas_in = NULL;
-    canvas_in = (uint8_t *)malloc(he*ve);
-    if (canvas_in == NULL)
+    // 反色合并到亮度、对比度的查找表中，灰度化之后只需查一次表
+    for (i = 0; i < 256; i++)
     {
-        return IMG_MEM_WRONG;
+        lut[i] = ctx->param.is_invert ? ~ctx->luminance_lut[i] : ctx->luminance_lut[i];
     }
-    memset(canvas_in, 0, he*ve);
-    memset(out, 0, h*v);
 
-    // 图像边缘向外扩展1像素，复制原图到中心位置
-    for (i = 0; i < v; i++)
+    line = (uint8_t *)malloc(h * 8);
+    if (line == NULL)
     {
-        memcpy(&canvas_in[(i+1)*he+1], &in[i*h], h);
+        return IMG_MEM_WRONG;
     }
 
-    // 扩散矩阵
-    // ...  ...  src  7/16  ...
-    // ...  3/16 5/16 1/16  ...
-    for (i = 0; i < v; i++)
+    for (y = 0; y < v; y += 8)
     {
-        for (j = 0; j < h; j++)
+        rows = v - y < 8 ? v - y : 8;
+        for (i = 0; i < rows; i++)
         {
-            uint8_t *pixel = NULL;
-            uint8_t *p_in = &canvas_in[(i+1)*he+j+1];
-            uint8_t *p_out = &out[i*h+j];
-            int8_t p_err = 0;
-
-            // 计算误差
-            dither_color_space_bitmap(p_in, p_out, &p_err);
-
-            // 扩散误差
-            pixel = &canvas_in[(i+1)*he+j+1];
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err, 7);
-
-            pixel += he - 2;
-            *pixel = dither_limit_denominator_16(*pixel, p_err, 3);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err, 5);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err, 1);
+            rgb8882gray(&ctx->in_buf.buf[(y + i) * h * 3], &line[i * h], h, 1);
+            gray_luminance(&line[i * h], &line[i * h], h, 1, lut);
         }
+        bitmap_pack_band(line, h, out, h, v, y, rows, ctx->param.format);
     }
 
-    SAFE_FREE(canvas_in);
+    SAFE_FREE(line);
     return IMG_OK;
 }
 
-static img_err_code floyd_steinberg_dither_rgb888(uint8_t *in, uint8_t *out, int32_t h, int32_t v,
-                                                  void(*dither_color_space)(pixel_rgb888 *in, pixel_rgb888 *out, pixel_rgb_err *err))
+// 16位格式使用误差扩散时，量化的同时按字节序写出最终数据，不经过 stage_buf，也不需要再转换和交换字节
+static img_err_code img_enc_dither_word(_img_enc_ctx *ctx, uint8_t *out)
 {
-    // 参考资料
-    // https://blog.csdn.net/qq_42676511/article/details/120626723
-    // https://github.com/Rudranil-Sarkar/Floyd-Steinberg-dithering-algo/blob/master/bitmap.cpp
-
-    int32_t he = h + 2;
-    int32_t ve = v + 2;
-    int32_t i, j;
+    dither_pack pack;
+    dither_pixels func = NULL;
+
+    switch (ctx->param.format)
+    {
+    case FMT_RGB565:
+        func = floyd_steinberg_pixels_rgb565;
+        break;
+    case FMT_BGR565:
+        func = floyd_steinberg_pixels_bgr565;
+        break;
+    case FMT_ARGB1555:
+        func = floyd_steinberg_pixels_argb1555;
+        break;
+    case FMT_BGRA5551:
+        func = floyd_steinberg_pixels_bgra5551;
+        break;
+    default:
+        return IMG_OTHER_ERR;
+    }
+    pack.transparence = ctx->param.transparence;
+    pack.use_key = TRANSPARENCE_ENABLE(ctx->param.transparence);
+    pack.is_big_endian = ctx->param.is_big_endian;
+    return floyd_steinberg_dither(ctx->in_buf.buf, out, ctx->in_buf.width, ctx->in_buf.height, 3, 2,
+                                  func, &pack, ctx->threads);
+}
 
-    uint8_t *canvas_in = NULL;
-    canvas_in = (uint8_t *)malloc(he*ve*3);
-    if (canvas_in == NULL)
+// 输出格式分类，分类相同时预处理的步骤完全一致
+static int32_t fmt_class(fmt_e format)
+{
+    if (format >= FMT_BITMAP_RL && format <= FMT_BITMAP_CRM)
     {
-        return IMG_MEM_WRONG;
+        return 0;
     }
-    memset(canvas_in, 0, he*ve*3);
-    memset(out, 0, h*v*3);
-
-    // 图像边缘向外扩展1像素，复制原图到中心位置
-    for (i = 0; i < v; i++)
+    if (format == FMT_WEB)
     {
-        memcpy(&canvas_in[(i+1)*he*3 + 3], &in[i*h*3], h * 3);
+        return 1;
     }
-
-    // 抖动算法
-    for (i = 0; i < v; i++)
-    {
-        for (j = 0; j < h; j++)
-        {
-            uint8_t *pixel = NULL;
-            pixel_rgb888 *p_in = (pixel_rgb888 *)&canvas_in[(i+1)*he*3+(j+1)*3];
-            pixel_rgb888 *p_out = (pixel_rgb888 *)&out[i*h*3+j*3];
-            pixel_rgb_err p_err = {0};
-
-            // 计算误差
-            dither_color_space(p_in, p_out, &p_err);
-            
-            // 扩散误差
-            pixel = &canvas_in[(i+1)*he*3+(j+1)*3];
-            pixel += 3;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[0], 7);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[1], 7);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[2], 7);
-
-            pixel += he * 3 - 9;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[0], 3);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[1], 3);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[2], 3);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[0], 5);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[1], 5);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[2], 5);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[0], 1);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[1], 1);
-            pixel += 1;
-            *pixel = dither_limit_denominator_16(*pixel, p_err[2], 1);
-        }
-    }
-
-    SAFE_FREE(canvas_in);
-    return IMG_OK;
+    return 2;
 }
 
-static void color_invert(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 步骤第一次执行时才分配它的缓存，web和16位格式用不到位图的各个步骤，直接输出的格式一个都不分配
+// 只有彩色图像的抖动结果为rgb888，其余步骤都是灰度图像
+static img_err_code stage_buf_alloc(_img_buf *buf, _stage_e stage, const _img_buf *in)
 {
-    int32_t i;
-    for (i = 0; i < h*v; i++)
+    if (buf->buf)
     {
-        out[i] = ~in[i];
+        return IMG_OK;
     }
-    return;
+    buf->buf = (uint8_t *)malloc((size_t)in->width * in->height * (stage == STAGE_DITHER ? 3 : 1));
+    if (buf->buf == NULL)
+    {
+        printf("create img buf error\n");
+        return IMG_MEM_WRONG;
+    }
+    return IMG_OK;
 }
 
-// 每一步处理完成后调换 effect_buf_prev 和 effect_buf_next，处理完成后 effect_buf_prev 内保存最终的图像
-static img_err_code img_enc_effect(img_enc_ctx *img)
+// 执行预处理的一个步骤，in为上一步的输出，步骤未启用时 *out 直接指向 in
+static img_err_code img_enc_stage(_img_enc_ctx *ctx, _stage_e stage, _img_buf *in, _img_buf **out)
 {
     img_err_code err_code = IMG_OK;
-    _img_buf img_buf_tmp;
-    uint32_t out_size = 0;
-    _img_enc_ctx *ctx = (_img_enc_ctx *)img;
-    out_size = ctx->in_buf.height * ctx->in_buf.width * 3;
+    _img_buf *buf = &ctx->stage_buf[stage];
+    int32_t is_bitmap = fmt_class(ctx->param.format) == 0;
 
-    memcpy(ctx->effect_buf_prev.buf, ctx->in_buf.buf, out_size);
-    ctx->effect_buf_prev.color = COLOR_RGB888;
-    ctx->effect_buf_prev.width = ctx->in_buf.width;
-    ctx->effect_buf_prev.height = ctx->in_buf.height;
-
-    if (ctx->param.format >= FMT_BITMAP_RL && ctx->param.format <= FMT_BITMAP_CRM)
+    *out = in;
+    switch (stage)
     {
+    case STAGE_GRAY:
+        if (!is_bitmap)
+        {
+            return IMG_OK;
+        }
+        if (stage_buf_alloc(buf, stage, in))
+        {
+            return IMG_MEM_WRONG;
+        }
         // rgb转灰度
-        rgb8882gray(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-        ctx->effect_buf_next.color = COLOR_GRAY_8;
-        ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-        ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-        img_buf_tmp = ctx->effect_buf_prev;
-        ctx->effect_buf_prev = ctx->effect_buf_next;
-        ctx->effect_buf_next = img_buf_tmp;
-
+        rgb8882gray(in->buf, buf->buf, in->width, in->height);
+        buf->color = COLOR_GRAY_8;
+        break;
+    case STAGE_LUMINANCE:
+        // 亮度和对比度都为0时图像不变
+        if (!is_bitmap || (ctx->param.luminance == 0 && ctx->param.contrast == 0))
+        {
+            return IMG_OK;
+        }
+        if (stage_buf_alloc(buf, stage, in))
+        {
+            return IMG_MEM_WRONG;
+        }
         // 灰度图像修改亮度
-        gray_luminance(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height,
-                       ctx->param.luminance, ctx->param.contrast);
-        ctx->effect_buf_next.color = COLOR_GRAY_8;
-        ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-        ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-        img_buf_tmp = ctx->effect_buf_prev;
-        ctx->effect_buf_prev = ctx->effect_buf_next;
-        ctx->effect_buf_next = img_buf_tmp;
-
+        gray_luminance(in->buf, buf->buf, in->width, in->height, ctx->luminance_lut);
+        buf->color = COLOR_GRAY_8;
+        break;
+    case STAGE_EDGE:
+        if (!is_bitmap || !ctx->param.use_edge_detector)
+        {
+            return IMG_OK;
+        }
+        if (stage_buf_alloc(buf, stage, in))
+        {
+            return IMG_MEM_WRONG;
+        }
         // 边缘识别
-        if (ctx->param.use_edge_detector)
+        err_code = sobel_edge_detector(in->buf, buf->buf, in->width, in->height, ctx->threads);
+        buf->color = COLOR_GRAY_8;
+        break;
+    case STAGE_DITHER:
+        if (!ctx->param.use_dithering_algorithm)
         {
-            err_code = sobel_edge_detector(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-            if (err_code)
-            {
-                return err_code;
-            }
-            ctx->effect_buf_next.color = COLOR_GRAY_8;
-            ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-            ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-            img_buf_tmp = ctx->effect_buf_prev;
-            ctx->effect_buf_prev = ctx->effect_buf_next;
-            ctx->effect_buf_next = img_buf_tmp;
+            return IMG_OK;
+        }
+        if (stage_buf_alloc(buf, stage, in))
+        {
+            return IMG_MEM_WRONG;
         }
-
         // 抖动
-        if (ctx->param.use_dithering_algorithm)
+        if (ctx->param.use_dithering_algorithm != DITHER_FLOYD_STEINBERG)
         {
-            err_code = floyd_steinberg_dither_gray8(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-            if (err_code)
-            {
-                return err_code;
-            }
-            ctx->effect_buf_next.color = COLOR_GRAY_8;
-            ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-            ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-            img_buf_tmp = ctx->effect_buf_prev;
-            ctx->effect_buf_prev = ctx->effect_buf_next;
-            ctx->effect_buf_next = img_buf_tmp;
+            err_code = ordered_dither(in->buf, buf->buf, in->width, in->height, is_bitmap ? 1 : 3,
+                                      fmt_class(ctx->param.format), ctx->param.use_dithering_algorithm, ctx->threads);
+            buf->color = is_bitmap ? COLOR_GRAY_8 : COLOR_RGB888;
         }
-
-        // 反色
-        if (ctx->param.is_invert)
+        else if (is_bitmap)
         {
-            color_invert(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-            ctx->effect_buf_next.color = COLOR_GRAY_8;
-            ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-            ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-            img_buf_tmp = ctx->effect_buf_prev;
-            ctx->effect_buf_prev = ctx->effect_buf_next;
-            ctx->effect_buf_next = img_buf_tmp;
+            err_code = floyd_steinberg_dither(in->buf, buf->buf, in->width, in->height, 1, 1,
+                                              floyd_steinberg_pixels_bitmap, NULL, ctx->threads);
+            buf->color = COLOR_GRAY_8;
         }
-    }
-    else if (ctx->param.format == FMT_WEB)
-    {
-        // 抖动
-        if (ctx->param.use_dithering_algorithm)
+        else
         {
-            err_code = floyd_steinberg_dither_rgb888(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf,
-                                                     ctx->effect_buf_prev.width, ctx->effect_buf_prev.height, dither_color_space_web);
-            if (err_code)
-            {
-                return err_code;
-            }
-            ctx->effect_buf_next.color = COLOR_RGB888;
-            ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-            ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-            img_buf_tmp = ctx->effect_buf_prev;
-            ctx->effect_buf_prev = ctx->effect_buf_next;
-            ctx->effect_buf_next = img_buf_tmp;
+            err_code = floyd_steinberg_dither(in->buf, buf->buf, in->width, in->height, 3, 3,
+                                              ctx->param.format == FMT_WEB ? floyd_steinberg_pixels_web : floyd_steinberg_pixels_rgb555,
+                                              NULL, ctx->threads);
+            buf->color = COLOR_RGB888;
+        }
+        break;
+    case STAGE_INVERT:
+        if (!is_bitmap || !ctx->param.is_invert)
+        {
+            return IMG_OK;
+        }
+        if (stage_buf_alloc(buf, stage, in))
+        {
+            return IMG_MEM_WRONG;
         }
+        // 反色
+        color_invert(in->buf, buf->buf, in->width, in->height);
+        buf->color = COLOR_GRAY_8;
+        break;
+    default:
+        return IMG_OTHER_ERR;
     }
-    else if (ctx->param.format >= FMT_RGB565 && ctx->param.format <= FMT_BGRA5551)
+    if (err_code)
     {
-        // 抖动
-        if (ctx->param.use_dithering_algorithm)
+        return err_code;
+    }
+
+    buf->width = in->width;
+    buf->height = in->height;
+    *out = buf;
+    return IMG_OK;
+}
+
+// 从第一个失效的步骤开始依次处理，处理完成后 stage_out[STAGE_NUM - 1] 内保存最终的图像
+static img_err_code img_enc_effect(img_enc_ctx *img)
+{
+    img_err_code err_code = IMG_OK;
+    _img_enc_ctx *ctx = (_img_enc_ctx *)img;
+    _img_buf *prev = NULL;
+
+    prev = ctx->stage_valid > 0 ? ctx->stage_out[ctx->stage_valid - 1] : &ctx->in_buf;
+    while (ctx->stage_valid < STAGE_NUM)
+    {
+        err_code = img_enc_stage(ctx, ctx->stage_valid, prev, &ctx->stage_out[ctx->stage_valid]);
+        if (err_code)
         {
-            err_code = floyd_steinberg_dither_rgb888(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf,
-                                                     ctx->effect_buf_prev.width, ctx->effect_buf_prev.height, dither_color_space_rgb555);
-            if (err_code)
-            {
-                return err_code;
-            }
-            ctx->effect_buf_next.color = COLOR_RGB888;
-            ctx->effect_buf_next.width = ctx->effect_buf_prev.width;
-            ctx->effect_buf_next.height = ctx->effect_buf_prev.height;
-            img_buf_tmp = ctx->effect_buf_prev;
-            ctx->effect_buf_prev = ctx->effect_buf_next;
-            ctx->effect_buf_next = img_buf_tmp;
+            return err_code;
         }
+        prev = ctx->stage_out[ctx->stage_valid];
+        ctx->stage_valid++;
     }
 
     return IMG_OK;
@@ -757,7 +1811,7 @@ img_enc_ctx *img_enc_open(char *path)
 {
     FILE *img_fp;
     uint32_t buf_size;
-    _img_enc_ctx *ctx;
+    _img_enc_ctx *ctx = NULL;
     BMP_HEAD bh;
     img_err_code err_code = IMG_OK;
     char *ext_name;
@@ -794,21 +1848,16 @@ img_enc_ctx *img_enc_open(char *path)
         goto end;
     }
     memset(ctx, 0, sizeof(_img_enc_ctx));
+    ctx->threads = 1;
 
     buf_size = bh.bih.biHeight * bh.bih.biWidth * 3;
     ctx->in_buf.buf = (uint8_t *)malloc(buf_size);
-    ctx->effect_buf_prev.buf = (uint8_t *)malloc(buf_size);
-    ctx->effect_buf_next.buf = (uint8_t *)malloc(buf_size);
-    if (ctx->in_buf.buf == NULL ||
-        ctx->effect_buf_prev.buf == NULL ||
-        ctx->effect_buf_next.buf == NULL)
+    if (ctx->in_buf.buf == NULL)
     {
         printf("create img buf error\n");
         goto end;
     }
     memset(ctx->in_buf.buf, 0, buf_size);
-    memset(ctx->effect_buf_prev.buf, 0, buf_size);
-    memset(ctx->effect_buf_next.buf, 0, buf_size);
 
     if (load_bmp_data(img_fp, &bh, &ctx->in_buf))
     {
@@ -820,10 +1869,11 @@ img_enc_ctx *img_enc_open(char *path)
     return ctx;
 
 end:
-    SAFE_FREE(ctx->in_buf.buf);
-    SAFE_FREE(ctx->effect_buf_prev.buf);
-    SAFE_FREE(ctx->effect_buf_next.buf);
-    SAFE_FREE(ctx);
+    if (ctx != NULL)
+    {
+        SAFE_FREE(ctx->in_buf.buf);
+        SAFE_FREE(ctx);
+    }
     fclose(img_fp);
     return NULL;
 }
@@ -835,10 +1885,13 @@ img_err_code img_enc_close(img_enc_ctx *img)
         return IMG_PARAM_NULL_PTR;
     }
     _img_enc_ctx *ctx = (_img_enc_ctx *)img;
+    int32_t i = 0;
 
     SAFE_FREE(ctx->in_buf.buf);
-    SAFE_FREE(ctx->effect_buf_prev.buf);
-    SAFE_FREE(ctx->effect_buf_next.buf);
+    for (i = 0; i < STAGE_NUM; i++)
+    {
+        SAFE_FREE(ctx->stage_buf[i].buf);
+    }
     SAFE_FREE(ctx);
 
     return IMG_OK;
@@ -864,6 +1917,35 @@ img_err_code img_enc_cfg(img_enc_ctx *img, img_enc_param *param)
     {
         return IMG_PARAM_INVALID;
     }
+    if (param->use_dithering_algorithm < DITHER_NONE || param->use_dithering_algorithm >= DITHER_INVALID)
+    {
+        return IMG_PARAM_INVALID;
+    }
+
+    // 找到第一个受参数修改影响的步骤，之前步骤的结果可以继续使用
+    if (fmt_class(param->format) != fmt_class(ctx->param.format))
+    {
+        ctx->stage_valid = STAGE_GRAY;
+    }
+    if (param->luminance != ctx->param.luminance || param->contrast != ctx->param.contrast || !ctx->lut_valid)
+    {
+        luminance_lut_init(ctx->luminance_lut, param->luminance, param->contrast);
+        ctx->lut_valid = 1;
+        ctx->stage_valid = ctx->stage_valid < STAGE_LUMINANCE ? ctx->stage_valid : STAGE_LUMINANCE;
+    }
+    if (param->use_edge_detector != ctx->param.use_edge_detector)
+    {
+        ctx->stage_valid = ctx->stage_valid < STAGE_EDGE ? ctx->stage_valid : STAGE_EDGE;
+    }
+    // 16位格式的抖动按rgb555处理，和具体格式无关，web格式只有一种
+    if (param->use_dithering_algorithm != ctx->param.use_dithering_algorithm)
+    {
+        ctx->stage_valid = ctx->stage_valid < STAGE_DITHER ? ctx->stage_valid : STAGE_DITHER;
+    }
+    if (param->is_invert != ctx->param.is_invert)
+    {
+        ctx->stage_valid = ctx->stage_valid < STAGE_INVERT ? ctx->stage_valid : STAGE_INVERT;
+    }
     ctx->param = *param;
 
     // 宽度或高度需要向上对8取整，例如15*9像素的图片，横向需要(15 / 8) * 9 = 18字节内存，纵向需要 15 * (9 / 8) = 30 字节内存
@@ -885,11 +1967,13 @@ img_err_code img_enc_cfg(img_enc_ctx *img, img_enc_param *param)
     {
         ctx->img_size = ctx->in_buf.height * ctx->in_buf.width;
     }
-    else if (param->format >= FMT_RGB565 && param->format <= FMT_ARGB1555)
+    else if (param->format >= FMT_RGB565 && param->format <= FMT_BGRA5551)
     {
         ctx->img_size = ctx->in_buf.height * ctx->in_buf.width * 2;
     }
-    ctx->func = convert_list[param->format];
+    ctx->func = param->format <= FMT_WEB ? convert_list[param->format] : NULL;
+    ctx->func_rgb16 = param->format >= FMT_RGB565 ?
+        convert_rgb16_list[param->format - FMT_RGB565][param->is_big_endian != 0][TRANSPARENCE_ENABLE(param->transparence)] : NULL;
 
     ctx->width = ctx->in_buf.width;
     ctx->height = ctx->in_buf.height;
@@ -898,6 +1982,22 @@ img_err_code img_enc_cfg(img_enc_ctx *img, img_enc_param *param)
     return IMG_OK;
 }
 
+img_err_code img_enc_set_threads(img_enc_ctx *img, int32_t threads)
+{
+    if (img == NULL)
+    {
+        return IMG_PARAM_NULL_PTR;
+    }
+    if (threads < 1)
+    {
+        return IMG_PARAM_INVALID;
+    }
+    _img_enc_ctx *ctx = (_img_enc_ctx *)img;
+    ctx->threads = threads;
+
+    return IMG_OK;
+}
+
 img_err_code img_enc_get_preview_size(img_enc_ctx *img, int32_t *size, int32_t *width, int32_t *height)
 {
     if (img == NULL || size == NULL || width == NULL || height == NULL)
@@ -930,6 +2030,7 @@ img_err_code img_enc_preview(img_enc_ctx *img, void *data, int32_t len)
 {
     img_err_code err_code = IMG_OK;
     _img_enc_ctx *ctx = NULL;
+    _img_buf *final = NULL;
     uint32_t out_size = 0;
     if (img == NULL || data == NULL)
     {
@@ -949,14 +2050,16 @@ img_err_code img_enc_preview(img_enc_ctx *img, void *data, int32_t len)
     {
         return err_code;
     }
+    final = ctx->stage_out[STAGE_NUM - 1];
 
+    // 预处理的结果之后还要继续使用，后续的转换都在data中进行
     if (ctx->param.format >= FMT_BITMAP_RL && ctx->param.format <= FMT_BITMAP_CRM)
     {
-        if (ctx->effect_buf_prev.color == COLOR_GRAY_8)
+        if (final->color == COLOR_GRAY_8)
         {
-            // 二值化并转为rgb
-            gray2binarization(ctx->effect_buf_prev.buf, ctx->effect_buf_next.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-            gray2rgb888(ctx->effect_buf_next.buf, data, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
+            // 二值化并转为rgb，data的前1/3作为二值化的临时内存，转rgb时从后往前写不会覆盖未读取的数据
+            gray2binarization(final->buf, data, final->width, final->height);
+            gray2rgb888(data, data, final->width, final->height);
         }
         else
         {
@@ -965,11 +2068,11 @@ img_err_code img_enc_preview(img_enc_ctx *img, void *data, int32_t len)
     }
     else if (ctx->param.format == FMT_WEB)
     {
-        // 色彩转换
-        rgb8882rgb888_web(ctx->effect_buf_prev.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-        if (ctx->effect_buf_prev.color == COLOR_RGB888)
+        if (final->color == COLOR_RGB888)
         {
-            memcpy(data, ctx->effect_buf_prev.buf, out_size);
+            // 色彩转换
+            memcpy(data, final->buf, out_size);
+            rgb8882rgb888_web(data, final->width, final->height);
         }
         else
         {
@@ -978,11 +2081,11 @@ img_err_code img_enc_preview(img_enc_ctx *img, void *data, int32_t len)
     }
     else if (ctx->param.format >= FMT_RGB565 && ctx->param.format <= FMT_BGRA5551)
     {
-        // 色彩转换
-        rgb8882rgb888_rgb555(ctx->effect_buf_prev.buf, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-        if (ctx->effect_buf_prev.color == COLOR_RGB888)
+        if (final->color == COLOR_RGB888)
         {
-            memcpy(data, ctx->effect_buf_prev.buf, out_size);
+            // 色彩转换
+            memcpy(data, final->buf, out_size);
+            rgb8882rgb888_rgb555(data, final->width, final->height);
         }
         else
         {
@@ -997,6 +2100,7 @@ img_err_code img_enc(img_enc_ctx *img, void *data, int32_t len)
 {
     img_err_code err_code = IMG_OK;
     _img_enc_ctx *ctx = NULL;
+    _img_buf *final = NULL;
     if (img == NULL || data == NULL)
     {
         return IMG_PARAM_NULL_PTR;
@@ -1008,280 +2112,404 @@ img_err_code img_enc(img_enc_ctx *img, void *data, int32_t len)
     }
     memset(data, 0, len);
 
+    // 预览后直接保存时预处理的结果仍然有效，不需要重新计算
+    if (ctx->param.format <= FMT_BITMAP_CRM && !ctx->param.use_dithering_algorithm && !ctx->param.use_edge_detector &&
+        ctx->stage_valid < STAGE_NUM)
+    {
+        return img_enc_bitmap_row(ctx, data);
+    }
+    if (fmt_class(ctx->param.format) == 2 && ctx->param.use_dithering_algorithm == DITHER_FLOYD_STEINBERG &&
+        ctx->stage_valid <= STAGE_DITHER)
+    {
+        return img_enc_dither_word(ctx, data);
+    }
+
     // 预处理
     err_code = img_enc_effect(img);
     if (err_code)
     {
         return err_code;
     }
+    final = ctx->stage_out[STAGE_NUM - 1];
 
-    if (ctx->param.format <= FMT_BITMAP_CRM)
-    {
-        ctx->func(ctx->effect_buf_prev.buf, data, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-    }
-    // 彩色的直接使用原图转换就行
-    else if (ctx->param.format <= FMT_BGR565)
-    {
-        ctx->func(ctx->effect_buf_prev.buf, data, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height);
-    }
-    else if (ctx->param.format == FMT_ARGB1555)
-    {
-        rgb888_to_argb1555(ctx->effect_buf_prev.buf, data, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height, ctx->param.transparence);
-    }
-    else if (ctx->param.format <= FMT_BGRA5551)
+    if (ctx->func != NULL)
     {
-        rgb888_to_bgra5551(ctx->effect_buf_prev.buf, data, ctx->effect_buf_prev.width, ctx->effect_buf_prev.height, ctx->param.transparence);
+        ctx->func(final->buf, data, final->width, final->height);
     }
-
-    // 大小端转换
-    if (ctx->param.is_big_endian &&
-        (ctx->param.format == FMT_RGB565   ||
-         ctx->param.format == FMT_BGR565   ||
-         ctx->param.format == FMT_ARGB1555 ||
-         ctx->param.format == FMT_BGRA5551 ) )
+    // 彩色的直接使用原图转换就行，字节序和透明色已经包含在转换函数中
+    else if (ctx->func_rgb16 != NULL)
     {
-        uint16_t *d         = (uint16_t *)data;
-        const uint16_t *end = d + ctx->effect_buf_prev.width * ctx->effect_buf_prev.height;
-        while (d < end) {
-            *d = ((*d & 0x00FF) << 8) | ((*d & 0xFF00) >> 8);
-            d++;
-        }
+        ctx->func_rgb16(final->buf, data, final->width * final->height, ctx->param.transparence);
     }
 
     return IMG_OK;
 }
 
-static void rgb888_to_bitmap_rl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 灰度值不小于128的点为1，正好是字节的最高位，可以直接用 movemask 取出
+// 行打包：一行中连续8个点组成一个字节，out为第一个字节的位置，相邻字节间隔step，from为8的倍数
+static void bitmap_pack_row_c(const uint8_t *in, uint8_t *out, int32_t step, int32_t from, int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
-    int32_t he = (h + 7) >> 3;
+    int32_t x = 0, k = 0;
+    uint8_t byte = 0;
 
-    for (y = 0; y < v; y++)
+    for (x = from; x < n; x += 8)
     {
-        for (x = 0; x < h; x++)
+        byte = 0;
+        for (k = 0; k < 8 && x + k < n; k++)
         {
-            if (in[y * h + x] < 128)
+            if (in[x + k] >= 128)
             {
-                continue;
+                byte |= msb ? 0x80 >> k : 0x01 << k;
             }
-            out[he * y + (x >> 3)] = out[he * y + (x >> 3)] | (0x01 << (x & 0x07));
         }
+        out[(x >> 3) * step] = byte;
     }
 }
 
-static void rgb888_to_bitmap_rm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 列打包：rows行（最多8行）中同一列的点组成一个字节，不足8行的部分为0，out为第一列的位置，相邻列间隔step
+static void bitmap_pack_col_c(const uint8_t *in, int32_t stride, int32_t rows, uint8_t *out, int32_t step,
+                              int32_t from, int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
-    int32_t he = (h + 7) >> 3;
+    int32_t x = 0, k = 0;
+    uint8_t byte = 0;
 
-    for (y = 0; y < v; y++)
+    for (x = from; x < n; x++)
     {
-        for (x = 0; x < h; x++)
+        byte = 0;
+        for (k = 0; k < rows; k++)
         {
-            if (in[y * h + x] < 128)
+            if (in[k * stride + x] >= 128)
             {
-                continue;
+                byte |= msb ? 0x80 >> k : 0x01 << k;
             }
-            out[he * y + (x >> 3)] = out[he * y + (x >> 3)] | (0x80 >> (x & 0x07));
         }
+        out[x * step] = byte;
     }
 }
 
-static void rgb888_to_bitmap_cl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+#ifdef IMG_USE_X86_SIMD
+// SSE2 一次处理16个点，返回已处理的点数
+IMG_TARGET("sse2")
+static int32_t bitmap_pack_row_sse2(const uint8_t *in, uint8_t *out, int32_t step, int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
-    int32_t ve = (v + 7) >> 3;
+    int32_t x = 0, m = 0;
 
-    for (y = 0; y < v; y++)
+    for (x = 0; x + 16 <= n; x += 16)
     {
-        for (x = 0; x < h; x++)
+        __m128i p = _mm_loadu_si128((const __m128i *)(in + x));
+        if (msb)
         {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[ve * x + (y >> 3)] = out[ve * x + (y >> 3)] | (0x01 << (y & 0x07));
+            // 每8个字节内部倒序，第一个点落在最高位
+            p = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0x1B), 0x1B);
+            p = _mm_or_si128(_mm_srli_epi16(p, 8), _mm_slli_epi16(p, 8));
         }
+        m = _mm_movemask_epi8(p);
+        out[(x >> 3) * step] = (uint8_t)m;
+        out[((x >> 3) + 1) * step] = (uint8_t)(m >> 8);
     }
+    return x;
 }
 
-static void rgb888_to_bitmap_cm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// AVX2 一次处理32个点
+IMG_TARGET("avx2")
+static int32_t bitmap_pack_row_avx2(const uint8_t *in, uint8_t *out, int32_t step, int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
-    int32_t ve = (v + 7) >> 3;
+    const __m256i rev = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    int32_t x = 0, k = 0;
+    uint32_t m = 0;
 
-    for (y = 0; y < v; y++)
+    for (x = 0; x + 32 <= n; x += 32)
     {
-        for (x = 0; x < h; x++)
+        __m256i p = _mm256_loadu_si256((const __m256i *)(in + x));
+        if (msb)
         {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[ve * x + (y >> 3)] = out[ve * x + (y >> 3)] | (0x80 >> (y & 0x07));
+            p = _mm256_shuffle_epi8(p, rev);
+        }
+        m = (uint32_t)_mm256_movemask_epi8(p);
+        if (step == 1)
+        {
+            memcpy(out + (x >> 3), &m, 4);
+            continue;
+        }
+        for (k = 0; k < 4; k++)
+        {
+            out[((x >> 3) + k) * step] = (uint8_t)(m >> (k * 8));
         }
     }
+    return x;
 }
 
-static void rgb888_to_bitmap_rcl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// SSE2 8x16 字节转置，一次处理16列，每列8个点用一次 movemask 取出
+IMG_TARGET("sse2")
+static int32_t bitmap_pack_col_sse2(const uint8_t *in, int32_t stride, int32_t rows, uint8_t *out, int32_t step,
+                                    int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
+    __m128i r[8], a[8], b[8], c;
+    int32_t x = 0, k = 0, m = 0;
 
-    for (y = 0; y < v; y++)
+    for (x = 0; x + 16 <= n; x += 16)
     {
-        for (x = 0; x < h; x++)
+        // 高位在前时行倒序
+        for (k = 0; k < 8; k++)
         {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[y + v * (x >> 3)] = out[y + v * (x >> 3)] | (0x01 << (x & 0x07));
+            r[msb ? 7 - k : k] = k < rows ? _mm_loadu_si128((const __m128i *)(in + k * stride + x)) : _mm_setzero_si128();
+        }
+        for (k = 0; k < 4; k++)
+        {
+            a[k * 2] = _mm_unpacklo_epi8(r[k * 2], r[k * 2 + 1]);
+            a[k * 2 + 1] = _mm_unpackhi_epi8(r[k * 2], r[k * 2 + 1]);
+        }
+        // b[0] b[1] 为第0~3、4~7列的0~3行，b[2] b[3] 为第0~3、4~7列的4~7行，b[4]~b[7] 为第8~15列
+        for (k = 0; k < 2; k++)
+        {
+            b[k * 4 + 0] = _mm_unpacklo_epi16(a[k], a[k + 2]);
+            b[k * 4 + 1] = _mm_unpackhi_epi16(a[k], a[k + 2]);
+            b[k * 4 + 2] = _mm_unpacklo_epi16(a[k + 4], a[k + 6]);
+            b[k * 4 + 3] = _mm_unpackhi_epi16(a[k + 4], a[k + 6]);
+        }
+        for (k = 0; k < 4; k++)
+        {
+            c = (k & 1) ? _mm_unpackhi_epi32(b[(k >> 1) * 4 + 0], b[(k >> 1) * 4 + 2])
+                        : _mm_unpacklo_epi32(b[(k >> 1) * 4 + 0], b[(k >> 1) * 4 + 2]);
+            m = _mm_movemask_epi8(c);
+            out[(x + k * 4 + 0 - (k & 1) * 2) * step] = (uint8_t)m;
+            out[(x + k * 4 + 1 - (k & 1) * 2) * step] = (uint8_t)(m >> 8);
+            c = (k & 1) ? _mm_unpackhi_epi32(b[(k >> 1) * 4 + 1], b[(k >> 1) * 4 + 3])
+                        : _mm_unpacklo_epi32(b[(k >> 1) * 4 + 1], b[(k >> 1) * 4 + 3]);
+            m = _mm_movemask_epi8(c);
+            out[(x + k * 4 + 4 - (k & 1) * 2) * step] = (uint8_t)m;
+            out[(x + k * 4 + 5 - (k & 1) * 2) * step] = (uint8_t)(m >> 8);
         }
     }
+    return x;
 }
+#endif
 
-static void rgb888_to_bitmap_rcm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void bitmap_pack_row(const uint8_t *in, uint8_t *out, int32_t step, int32_t n, int32_t msb)
 {
-    int32_t x = 0, y = 0;
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    uint32_t flags = img_cpu_flags();
+    if (flags & IMG_CPU_AVX2)
+    {
+        done = bitmap_pack_row_avx2(in, out, step, n, msb);
+    }
+    else if (flags & IMG_CPU_SSE2)
+    {
+        done = bitmap_pack_row_sse2(in, out, step, n, msb);
+    }
+#endif
+    bitmap_pack_row_c(in, out, step, done, n, msb);
+}
 
-    for (y = 0; y < v; y++)
+static void bitmap_pack_col(const uint8_t *in, int32_t stride, int32_t rows, uint8_t *out, int32_t step,
+                            int32_t n, int32_t msb)
+{
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    if (img_cpu_flags() & IMG_CPU_SSE2)
     {
-        for (x = 0; x < h; x++)
-        {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[y + v * (x >> 3)] = out[y + v * (x >> 3)] | (0x80 >> (x & 0x07));
-        }
+        done = bitmap_pack_col_sse2(in, stride, rows, out, step, n, msb);
     }
+#endif
+    bitmap_pack_col_c(in, stride, rows, out, step, done, n, msb);
 }
 
-static void rgb888_to_bitmap_crl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+// 打包第y行开始的rows行灰度数据，y为8的倍数，rows最多8行，in中相邻行间隔stride
+// 每个字节都由一次写入完成，不需要预先清零，也不依赖out原有的内容
+static void bitmap_pack_band(const uint8_t *in, int32_t stride, uint8_t *out, int32_t h, int32_t v, int32_t y,
+                             int32_t rows, fmt_e format)
 {
-    int32_t x = 0, y = 0;
+    int32_t he = (h + 7) >> 3;
+    int32_t ve = (v + 7) >> 3;
+    int32_t msb = format == FMT_BITMAP_RM || format == FMT_BITMAP_CM ||
+                  format == FMT_BITMAP_RCM || format == FMT_BITMAP_CRM;
+    int32_t k = 0;
 
-    for (y = 0; y < v; y++)
+    switch (format)
     {
-        for (x = 0; x < h; x++)
+    case FMT_BITMAP_RL:
+    case FMT_BITMAP_RM:
+        for (k = 0; k < rows; k++)
         {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[x + h * (y >> 3)] = out[x + h * (y >> 3)] | (0x01 << (y & 0x07));
+            bitmap_pack_row(&in[k * stride], &out[he * (y + k)], 1, h, msb);
+        }
+        break;
+    case FMT_BITMAP_RCL:
+    case FMT_BITMAP_RCM:
+        for (k = 0; k < rows; k++)
+        {
+            bitmap_pack_row(&in[k * stride], &out[y + k], v, h, msb);
         }
+        break;
+    case FMT_BITMAP_CL:
+    case FMT_BITMAP_CM:
+        bitmap_pack_col(in, stride, rows, &out[y >> 3], ve, h, msb);
+        break;
+    case FMT_BITMAP_CRL:
+    case FMT_BITMAP_CRM:
+        bitmap_pack_col(in, stride, rows, &out[h * (y >> 3)], 1, h, msb);
+        break;
+    default:
+        break;
     }
 }
 
-static void rgb888_to_bitmap_crm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+static void rgb888_to_bitmap(uint8_t *in, uint8_t *out, int32_t h, int32_t v, fmt_e format)
 {
-    int32_t x = 0, y = 0;
+    int32_t y = 0;
 
-    for (y = 0; y < v; y++)
+    for (y = 0; y < v; y += 8)
     {
-        for (x = 0; x < h; x++)
-        {
-            if (in[y * h + x] < 128)
-            {
-                continue;
-            }
-            out[x + h * (y >> 3)] = out[x + h * (y >> 3)] | (0x80 >> (y & 0x07));
-        }
+        bitmap_pack_band(&in[y * h], h, out, h, v, y, v - y < 8 ? v - y : 8, format);
     }
 }
 
-static void rgb888_to_web(uint8_t *in, uint8_t *out, int h, int v)
+static void rgb888_to_bitmap_rl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
 {
-    uint8_t *d         = (uint8_t *)out;
-    const uint8_t *s   = in;
-    const uint8_t *end = s + h * v * 3;
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_RL);
+}
 
-    while (s < end) {
-        uint8_t r = *s++;
-        uint8_t g = *s++;
-        uint8_t b = *s++;
-        // 0,26,77,128,179,229,255 量化相对而言效果略好
-        // 0,42,85,128,170,213,255 量化最简单直接
-        r = r > 229 ? 5 : (r + 26) / 51;
-        g = g > 229 ? 5 : (g + 26) / 51;
-        b = b > 229 ? 5 : (b + 26) / 51;
-        *d++ = r * 36 + g * 6 + b;
-    }
+static void rgb888_to_bitmap_rm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_RM);
 }
 
-static void rgb888_to_rgb565(uint8_t *in, uint8_t *out, int h, int v)
+static void rgb888_to_bitmap_cl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
 {
-    uint16_t *d        = (uint16_t *)out;
-    const uint8_t *s   = in;
-    const uint8_t *end = s + h * v * 3;
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_CL);
+}
 
-    while (s < end) {
-        const int r = *s++;
-        const int g = *s++;
-        const int b = *s++;
-        *d++        = (b >> 3) | ((g & 0xFC) << 3) | ((r & 0xF8) << 8);
-    }
+static void rgb888_to_bitmap_cm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_CM);
+}
+
+static void rgb888_to_bitmap_rcl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_RCL);
+}
+
+static void rgb888_to_bitmap_rcm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_RCM);
+}
+
+static void rgb888_to_bitmap_crl(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_CRL);
+}
+
+static void rgb888_to_bitmap_crm(uint8_t *in, uint8_t *out, int32_t h, int32_t v)
+{
+    rgb888_to_bitmap(in, out, h, v, FMT_BITMAP_CRM);
 }
 
-static void rgb888_to_bgr565(uint8_t *in, uint8_t *out, int h, int v)
+static void rgb888_to_web_c(const uint8_t *in, uint8_t *out, int32_t n)
 {
-    uint16_t *d        = (uint16_t *)out;
-    const uint8_t *s   = in;
-    const uint8_t *end = s + h * v * 3;
+    int32_t i = 0;
 
-    while (s < end) {
-        const int r = *s++;
-        const int g = *s++;
-        const int b = *s++;
-        *d++        = ((b & 0xF8) << 8) | ((g & 0xFC) << 3) | (r >> 3);
+    for (i = 0; i < n; i++)
+    {
+        out[i] = web_level[in[i*3+0]] * 36 + web_level[in[i*3+1]] * 6 + web_level[in[i*3+2]];
     }
 }
 
-static void rgb888_to_argb1555(uint8_t *in, uint8_t *out, int h, int v, uint32_t transparence)
+#ifdef IMG_USE_X86_SIMD
+// SSSE3 一次处理16个像素，取出r、g、b的方式与灰度化相同，量化后直接计算调色板序号 r*36+g*6+b
+IMG_TARGET("ssse3")
+static int32_t rgb888_to_web_ssse3(const uint8_t *in, uint8_t *out, int32_t n)
 {
-    uint16_t *d        = (uint16_t *)out;
-    const uint8_t *s   = in;
-    const uint8_t *end = s + h * v * 3;
-    uint8_t tr = (transparence >> 16) & 0xFF;
-    uint8_t tg = (transparence >> 8) & 0xFF;
-    uint8_t tb = (transparence >> 0) & 0xFF;
+    const __m128i mul[3] = {_mm_set1_epi16(36), _mm_set1_epi16(6), _mm_set1_epi16(1)};
+    const __m128i bias = _mm_set1_epi16(26);
+    const __m128i div_51 = _mm_set1_epi16(1286);
+    __m128i shuf[4][3];
+    int32_t i = 0, k = 0;
 
-    while (s < end) {
-        const int r = *s++;
-        const int g = *s++;
-        const int b = *s++;
-        if (r == tr && g == tg && b == tb)
-        {
-            *d++ = 0;
-        }
-        else
+    for (k = 0; k < 12; k++)
+    {
+        shuf[k / 3][k % 3] = _mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i * 3));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i * 3 + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i * 3 + 32));
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        for (k = 0; k < 3; k++)
         {
-            *d++ = (b >> 3) | ((g & 0xF8) << 2) | ((r & 0xF8) << 7) | 0x8000;
+            __m128i x0 = _mm_or_si128(_mm_shuffle_epi8(a, shuf[0][k]), _mm_shuffle_epi8(b, shuf[1][k]));
+            __m128i x1 = _mm_or_si128(_mm_shuffle_epi8(b, shuf[2][k]), _mm_shuffle_epi8(c, shuf[3][k]));
+            x0 = _mm_mulhi_epu16(_mm_add_epi16(x0, bias), div_51);
+            x1 = _mm_mulhi_epu16(_mm_add_epi16(x1, bias), div_51);
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(x0, mul[k]));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(x1, mul[k]));
         }
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
     }
+    return i;
 }
 
-static void rgb888_to_bgra5551(uint8_t *in, uint8_t *out, int h, int v, uint32_t transparence)
+// AVX2 一次处理32个像素，读取方式与 rgb8882gray_avx2 相同
+IMG_TARGET("avx2")
+static int32_t rgb888_to_web_avx2(const uint8_t *in, uint8_t *out, int32_t n)
 {
-    uint16_t *d        = (uint16_t *)out;
-    const uint8_t *s   = in;
-    const uint8_t *end = s + h * v * 3;
-    uint8_t tr = (transparence >> 16) & 0xFF;
-    uint8_t tg = (transparence >> 8) & 0xFF;
-    uint8_t tb = (transparence >> 0) & 0xFF;
+    const __m256i mul[3] = {_mm256_set1_epi16(36), _mm256_set1_epi16(6), _mm256_set1_epi16(1)};
+    const __m256i bias = _mm256_set1_epi16(26);
+    const __m256i div_51 = _mm256_set1_epi16(1286);
+    __m256i shuf[4][3];
+    int32_t i = 0, k = 0;
 
-    while (s < end) {
-        const int r = *s++;
-        const int g = *s++;
-        const int b = *s++;
-        if (r == tr && g == tg && b == tb)
-        {
-            *d++ = 0;
-        }
-        else
+    for (k = 0; k < 12; k++)
+    {
+        shuf[k / 3][k % 3] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)rgb_shuf[k / 3][k % 3]));
+    }
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        const uint8_t *s = in + i * 3;
+        __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s +  0))),
+                                            _mm_loadu_si128((const __m128i *)(s + 48)), 1);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 16))),
+                                            _mm_loadu_si128((const __m128i *)(s + 64)), 1);
+        __m256i c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(s + 32))),
+                                            _mm_loadu_si128((const __m128i *)(s + 80)), 1);
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+
+        for (k = 0; k < 3; k++)
         {
-            *d++ = ((b & 0xF8) << 8) | ((g & 0xF8) << 3) | (r >> 2) | 0x0001;
+            __m256i x0 = _mm256_or_si256(_mm256_shuffle_epi8(a, shuf[0][k]), _mm256_shuffle_epi8(b, shuf[1][k]));
+            __m256i x1 = _mm256_or_si256(_mm256_shuffle_epi8(b, shuf[2][k]), _mm256_shuffle_epi8(c, shuf[3][k]));
+            x0 = _mm256_mulhi_epu16(_mm256_add_epi16(x0, bias), div_51);
+            x1 = _mm256_mulhi_epu16(_mm256_add_epi16(x1, bias), div_51);
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(x0, mul[k]));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(x1, mul[k]));
         }
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_packus_epi16(lo, hi));
+    }
+    return i;
+}
+#endif
+
+static void rgb888_to_web(uint8_t *in, uint8_t *out, int h, int v)
+{
+    int32_t n = h * v;
+    int32_t done = 0;
+#ifdef IMG_USE_X86_SIMD
+    uint32_t cpu = img_cpu_flags();
+    if (cpu & IMG_CPU_AVX2)
+    {
+        done = rgb888_to_web_avx2(in, out, n);
+    }
+    else if (cpu & IMG_CPU_SSSE3)
+    {
+        done = rgb888_to_web_ssse3(in, out, n);
     }
+#endif
+    rgb888_to_web_c(in + done * 3, out + done, n - done);
 }
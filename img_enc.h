@@ -17,16 +17,28 @@
 #include <stdint.h>
 #include "img_common.h"
 
+// 颜色抖动算法
+typedef enum
+{
+    DITHER_NONE = 0, // 不抖动
+    DITHER_FLOYD_STEINBERG = 1, // Floyd-Steinberg 误差扩散
+    DITHER_BAYER_2 = 2, // 2x2 Bayer 矩阵有序抖动
+    DITHER_BAYER_4 = 3, // 4x4 Bayer 矩阵有序抖动
+    DITHER_BAYER_8 = 4, // 8x8 Bayer 矩阵有序抖动
+    DITHER_BLUE_NOISE = 5, // 32x32 蓝噪声阈值矩阵，图案比Bayer矩阵自然
+    DITHER_INVALID,
+} dither_e;
+
 typedef struct
 {
     fmt_e format; // 输出图像格式
     int32_t is_big_endian; // 是否为大端格式，仅对rgb565等16位图像有效
     int32_t is_invert; // 是否反色，仅对bitmap格式有效
     int32_t use_edge_detector; // 是否使用边缘检测，仅对bitmap格式有效
-    int32_t use_dithering_algorithm; // 是否使用颜色抖动，对所有图像格式有效
+    dither_e use_dithering_algorithm; // 颜色抖动算法，对所有图像格式有效
     int32_t luminance; // 调整亮度，默认值0，取值范围+-100，仅对bitmap格式有效
     int32_t contrast; // 调整对比度，默认值0，取值范围+-100，仅对bitmap格式有效
-    uint32_t transparence; // 透明色，格式为0x00RRGGBB，仅对argb和bgra格式有效
+    uint32_t transparence; // 透明色，格式为0x00RRGGBB，仅对argb和bgra格式有效，最高字节不为0时不使用透明色
 } img_enc_param;
 
 typedef void img_enc_ctx;
@@ -56,6 +68,16 @@ img_err_code img_enc_close(img_enc_ctx *img);
  */
 img_err_code img_enc_cfg(img_enc_ctx *img, img_enc_param *param);
 
+/**
+ * @brief 设置编码时使用的线程数，用于边缘识别和抖动
+ * @note 默认为1，结果与线程数无关
+ * 
+ * @param img 编码器指针
+ * @param threads 线程数量，包括调用线程
+ * @return img_err_code 错误码
+ */
+img_err_code img_enc_set_threads(img_enc_ctx *img, int32_t threads);
+
 /**
  * @brief 获取预览图像的大小
  * 
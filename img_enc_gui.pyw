@@ -2,7 +2,7 @@
 
 '''
 gcc 编译dll
-gcc -shared -o img_enc.dll .\img_common.c .\img_enc.c
+gcc -shared -o img_enc.dll .\img_common.c .\img_enc.c -lpthread
 '''
 
 import tkinter as tk
@@ -26,6 +26,9 @@ G_GRID_PADY = 5
 LUMINANCE_CONTRAST_MIN = -100
 LUMINANCE_CONTRAST_MAX = 100
 
+# 边缘识别、抖动使用的线程数
+ENC_THREADS = os.cpu_count() or 1
+
 UINT8_MIN = 0
 UINT8_MAX = 255
 
@@ -73,6 +76,9 @@ img_enc_dll.img_enc_close.restype = c_int
 img_enc_dll.img_enc_cfg.argtypes = [c_void_p, c_void_p]
 img_enc_dll.img_enc_cfg.restype = c_int
 
+img_enc_dll.img_enc_set_threads.argtypes = [c_void_p, c_int]
+img_enc_dll.img_enc_set_threads.restype = c_int
+
 img_enc_dll.img_enc_get_preview_size.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p]
 img_enc_dll.img_enc_get_preview_size.restype = c_int
 
@@ -186,13 +192,13 @@ def enc_cfg_read_all():
     img_enc_param.is_big_endian = endian_cbox.current()
     img_enc_param.is_invert = tk_img_is_invert.get()
     img_enc_param.use_edge_detector = tk_img_use_edge_detector.get()
-    img_enc_param.use_dithering_algorithm = tk_img_use_dithering_algorithm.get()
+    img_enc_param.use_dithering_algorithm = dither_cbox.current()
     img_enc_param.luminance = tk_img_luminance.get()
     img_enc_param.contrast = tk_img_contrast.get()
     r = tk_img_transparence_r.get()
     g = tk_img_transparence_g.get()
-    b = tk_img_transparence_r.get()
-    img_enc_param.transparence = r * 255 * 255 + g * 255 + b
+    b = tk_img_transparence_b.get()
+    img_enc_param.transparence = (r << 16) | (g << 8) | b
 
 def enc_cfg_set():
     rc = img_enc_dll.img_enc_cfg(img_enc_ptr, byref(img_enc_param))
@@ -223,6 +229,7 @@ def open_file():
     inputfile = create_string_buffer(file_path.encode("gbk"))
     img_enc_ptr = img_enc_dll.img_enc_open(inputfile)
     if (bool(img_enc_ptr)):
+        img_enc_dll.img_enc_set_threads(img_enc_ptr, ENC_THREADS)
         lb_status_content.configure(text="打开完成")
         entry_img_file.configure(state="readonly")
         bt_select_file.configure(state="disabled")
@@ -315,6 +322,7 @@ def convert_and_save(file):
     img_enc_ptr = img_enc_dll.img_enc_open(enc_file)
     if (not bool(img_enc_ptr)):
         return 1
+    img_enc_dll.img_enc_set_threads(img_enc_ptr, ENC_THREADS)
     
     rc = img_enc_dll.img_enc_cfg(img_enc_ptr, byref(img_enc_param))
     if (rc != 0):
@@ -393,8 +401,6 @@ tk_img_is_invert = tk.IntVar()
 tk_img_is_invert.trace("w", enc_cfg_spin_change)
 tk_img_use_edge_detector = tk.IntVar()
 tk_img_use_edge_detector.trace("w", enc_cfg_spin_change)
-tk_img_use_dithering_algorithm = tk.IntVar()
-tk_img_use_dithering_algorithm.trace("w", enc_cfg_spin_change)
 
 tk_img_luminance = tk.IntVar()
 tk_img_luminance.trace("w", enc_cfg_spin_change)
@@ -425,6 +431,16 @@ img_format_info = [
     "BGRA5551",
 ]
 
+# 与 dither_e 的顺序一致
+img_dither_info = [
+    "不抖动",
+    "误差扩散",
+    "Bayer 2x2",
+    "Bayer 4x4",
+    "Bayer 8x8",
+    "蓝噪声",
+]
+
 img_endian_info = [
     "小端",
     "大端",
@@ -553,8 +569,12 @@ ckbt_is_invert = tk.Checkbutton(lbfm_img_effect, text="反色", variable=tk_img_
 ckbt_is_invert.grid(row=0, column=0)
 ckbt_use_edge_detector = tk.Checkbutton(lbfm_img_effect, text="边缘检测", variable=tk_img_use_edge_detector, onvalue=1, offvalue=0, width=8, anchor=tk.W)
 ckbt_use_edge_detector.grid(row=1, column=0)
-ckbt_use_dithering_algorithm = tk.Checkbutton(lbfm_img_effect, text="颜色抖动", variable=tk_img_use_dithering_algorithm, onvalue=1, offvalue=0, width=8, anchor=tk.W)
-ckbt_use_dithering_algorithm.grid(row=2, column=0)
+dither_cbox = ttk.Combobox(lbfm_img_effect, width=9)
+dither_cbox.grid(row=2, column=0)
+dither_cbox["value"] = img_dither_info
+dither_cbox.configure(state="readonly")
+dither_cbox.current(0)
+dither_cbox.bind("<<ComboboxSelected>>", enc_cfg_change)
 
 
 
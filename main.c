@@ -20,6 +20,10 @@
 #include "img_enc.h"
 #include "img_common.h"
 
+#ifdef IMG_USE_THREAD
+#include <pthread.h>
+#endif
+
 #define SPECIFICATION \
 "==== format specification ====\n" \
 "bitmap_rl, bitmap_rm, bitmap_cl, bitmap_cm,\n" \
@@ -54,6 +58,20 @@ const fmt_s format_preset[] = {
 
 const fmt_s *aim_fmt = NULL;
 
+typedef struct {
+    dither_e dither;
+    char dither_str[12];
+} dither_s;
+
+const dither_s dither_preset[] = {
+    {DITHER_NONE           , "none"},
+    {DITHER_FLOYD_STEINBERG, "fs"},
+    {DITHER_BAYER_2        , "bayer2"},
+    {DITHER_BAYER_4        , "bayer4"},
+    {DITHER_BAYER_8        , "bayer8"},
+    {DITHER_BLUE_NOISE     , "bluenoise"},
+};
+
 // 全局变量
 FILE *fpw;
 FILE *fpr;
@@ -67,17 +85,24 @@ int32_t edge = 0; // 边缘检测算法
 int32_t dithering = 0; // 抖动算法
 int32_t luminance = 0; // 亮度
 int32_t contrast = 0; // 对比度
-uint32_t transparence = 0x12345678; // 透明色
+uint32_t transparence = 0x12345678; // 透明色，默认值最高字节不为0，不使用透明色
 
 int32_t decode_height = 0; // 解码图像的高度
 int32_t decode_width = 0; // 解码图像的宽度
-int32_t file_offset = 0;
 int32_t img_head_size = 0;
 int32_t img_tail_size = 0;
+int32_t jobs = 1; // 线程数
+int32_t prefetch = 0; // 预读图片数量
+int32_t decode_step = 1; // 解码时每隔几个点取一个点
+int32_t roi[4] = {0, 0, 0, 0}; // 解码区域 x,y,w,h，宽高为0表示到图片边缘
+int32_t sheet_cols = 0; // 拼图每行的图片数量，0表示自动选择
 
 char *mode_str = NULL;
 char *format_str = NULL;
 char *input_str = NULL;
+char *roi_str = NULL;
+char *file_offset_str = NULL; // 文件偏移量，可能超过2GB，自行转换为64位整数
+char *dither_str = NULL; // 抖动算法名称
 
 // argparse
 struct argparse argparse;
@@ -90,22 +115,28 @@ static const char *const usages[] = {
 struct argparse_option options[] = {
     OPT_HELP(),
     OPT_GROUP("Basic options"),
-    OPT_STRING('m', "mode", &mode_str, "convert mode, enc or dec", NULL, 0, 0),
+    OPT_STRING('m', "mode", &mode_str, "convert mode, enc, dec or sheet(all images in one picture)", NULL, 0, 0),
     OPT_STRING('f', "format", &format_str, "set input/output format(format specification see below)", NULL, 0, 0),
 
     OPT_BOOLEAN('r', "reverse", &invert_color, "invert color, only for encode and bitmap format, default FALSE", NULL, 0, 0),
     OPT_BOOLEAN('b', "bigendian", &big_endian, "big endian, only for 16bit format, e.g. rgb565, argb565, default FALSE", NULL, 0, 0),
     OPT_BOOLEAN('e', "edge", &edge, "use edge detector algorithm, only for encode and bitmap format, default FALSE", NULL, 0, 0),
     OPT_BOOLEAN('d', "dithering", &dithering, "use dithering algorithm, only for encode, default FALSE", NULL, 0, 0),
+    OPT_STRING(0, "dither", &dither_str, "dithering algorithm, none, fs, bayer2, bayer4, bayer8 or bluenoise, only for encode, -d is fs", NULL, 0, 0),
     OPT_INTEGER('l', "luminance", &luminance, "set luminance, only for encode and bitmap format, between -100 and +100, default 0", NULL, 0, 0),
     OPT_INTEGER('c', "contrast", &contrast, "set contrast, only for encode and bitmap format, between -100 and +100, default 0", NULL, 0, 0),
     OPT_INTEGER('t', "transparence", &transparence, "set a color as transparent color, only for encode and argb1555, bgra5551 format", NULL, 0, 0),
 
     OPT_INTEGER('W', "width", &decode_width, "set image width, only for decode", NULL, 0, 0),
     OPT_INTEGER('H', "height", &decode_height, "set image height, only for decode", NULL, 0, 0),
-    OPT_INTEGER('s', "shift", &file_offset, "file offset, only for decode", NULL, 0, 0),
+    OPT_STRING('s', "shift", &file_offset_str, "file offset, only for decode", NULL, 0, 0),
     OPT_INTEGER('H', "head", &img_head_size, "image head size, only for decode", NULL, 0, 0),
     OPT_INTEGER('T', "tail", &img_tail_size, "image tail size, only for decode", NULL, 0, 0),
+    OPT_INTEGER('j', "jobs", &jobs, "number of threads, for decode, edge detection and dithering, default 1", NULL, 0, 0),
+    OPT_INTEGER('p', "prefetch", &prefetch, "number of images to read ahead in background, only for decode, default 0", NULL, 0, 0),
+    OPT_STRING(0, "roi", &roi_str, "decode region x,y,w,h, w or h 0 means to the image edge, only for decode", NULL, 0, 0),
+    OPT_INTEGER(0, "step", &decode_step, "keep one pixel in every N, only for decode, default 1", NULL, 0, 0),
+    OPT_INTEGER(0, "cols", &sheet_cols, "number of images in one row, only for sheet, default close to square", NULL, 0, 0),
 
     OPT_STRING('i', "input", &input_str, "set input file", NULL, 0, 0),
     OPT_END(),
@@ -237,6 +268,264 @@ int32_t rgb888_dump_ppm(char *path, uint8_t *data, int32_t width, int32_t height
     return 0;
 }
 
+#ifdef IMG_USE_THREAD
+// 多线程解码
+// 每个解码线程独立打开文件，第k个线程解码第 k, k+jobs, k+2*jobs ... 张图片
+// 解码结果放入 slot_num 个缓存组成的环形队列，第i张图片使用第 i%slot_num 个缓存，主线程按顺序取出并保存
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    img_dec_param param;
+    int32_t dec_count; // 图片总数
+    int32_t slot_num; // 缓存数量
+    int32_t out_size; // 单个缓存的大小
+    uint8_t *slot_buf; // 全部缓存，大小为 slot_num * out_size
+    int32_t *slot_img; // 每个缓存中保存的图片序号，-1表示空闲
+    int32_t *slot_ret; // 每个缓存对应的解码错误码
+    int32_t save_count; // 已经保存的图片数量
+    int32_t stop; // 出错时通知所有线程退出
+} dec_pool;
+
+typedef struct {
+    dec_pool *pool;
+    pthread_t tid;
+    int32_t id;
+} dec_worker;
+
+static void *dec_worker_run(void *arg)
+{
+    dec_worker *worker = (dec_worker *)arg;
+    dec_pool *pool = worker->pool;
+    img_dec_ctx *ctx = NULL;
+    int32_t ret = 0;
+    int32_t i = 0;
+    int32_t slot = 0;
+    int32_t stop = 0;
+
+    ctx = img_dec_open(input_str);
+    if (ctx == NULL)
+    {
+        ret = IMG_OPEN_FILE_ERR;
+    }
+    else
+    {
+        ret = img_dec_cfg(ctx, &pool->param);
+        if (ret == IMG_OK)
+        {
+            ret = img_dec_set_rect(ctx, roi[0], roi[1], roi[2], roi[3], decode_step);
+        }
+    }
+
+    for (i = worker->id; i < pool->dec_count; i += jobs)
+    {
+        slot = i % pool->slot_num;
+
+        // 等待主线程保存完第 i-slot_num 张图片，腾出缓存
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && i - pool->save_count >= pool->slot_num)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        if (ret == IMG_OK)
+        {
+            img_dec_seek(ctx, SEEK_GOTO, i);
+            ret = img_dec(ctx, pool->slot_buf + (size_t)slot * pool->out_size, pool->out_size);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->slot_img[slot] = i;
+        pool->slot_ret[slot] = ret;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        if (ret)
+        {
+            break;
+        }
+    }
+
+    if (ctx)
+    {
+        img_dec_close(ctx);
+    }
+    return NULL;
+}
+
+static int32_t dec_parallel(img_dec_param *param, int32_t dec_count, int32_t out_width, int32_t out_height,
+                            char *name_with_count, char *separator)
+{
+    dec_pool pool;
+    dec_worker *worker = NULL;
+    int32_t worker_num = 0;
+    int32_t i = 0;
+    int32_t slot = 0;
+    int32_t ret = 0;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.param = *param;
+    pool.dec_count = dec_count;
+    pool.slot_num = jobs * 2;
+    pool.out_size = out_width * out_height * 3;
+    pool.slot_buf = (uint8_t *)malloc((size_t)pool.slot_num * pool.out_size);
+    pool.slot_img = (int32_t *)malloc(pool.slot_num * sizeof(int32_t));
+    pool.slot_ret = (int32_t *)malloc(pool.slot_num * sizeof(int32_t));
+    worker = (dec_worker *)malloc(jobs * sizeof(dec_worker));
+    if (pool.slot_buf == NULL || pool.slot_img == NULL || pool.slot_ret == NULL || worker == NULL)
+    {
+        printf("create decode threads error\n");
+        ret = IMG_MEM_WRONG;
+        goto end;
+    }
+    for (i = 0; i < pool.slot_num; i++)
+    {
+        pool.slot_img[i] = -1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    for (worker_num = 0; worker_num < jobs; worker_num++)
+    {
+        worker[worker_num].pool = &pool;
+        worker[worker_num].id = worker_num;
+        if (pthread_create(&worker[worker_num].tid, NULL, dec_worker_run, &worker[worker_num]))
+        {
+            printf("create decode threads error\n");
+            ret = IMG_OTHER_ERR;
+            break;
+        }
+    }
+
+    // 主线程按图片顺序保存
+    for (i = 0; i < dec_count && ret == 0; i++)
+    {
+        slot = i % pool.slot_num;
+
+        pthread_mutex_lock(&pool.lock);
+        while (pool.slot_img[slot] != i)
+        {
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        ret = pool.slot_ret[slot];
+        pthread_mutex_unlock(&pool.lock);
+        if (ret)
+        {
+            printf("dec error, code %d\n", ret);
+            break;
+        }
+
+        sprintf(separator, "_%05d", i);
+        change_ext_name(name_with_count, "ppm");
+        if(rgb888_dump_ppm(name_with_count, pool.slot_buf + (size_t)slot * pool.out_size, out_width, out_height) == 0)
+        {
+            printf("dec finish, save file in %s\n", name_with_count);
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        pool.slot_img[slot] = -1;
+        pool.save_count = i + 1;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < worker_num; i++)
+    {
+        pthread_join(worker[i].tid, NULL);
+    }
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+end:
+    SAFE_FREE(pool.slot_buf);
+    SAFE_FREE(pool.slot_img);
+    SAFE_FREE(pool.slot_ret);
+    SAFE_FREE(worker);
+    return ret;
+}
+#endif
+
+// 所有图片缩小后拼成一张图，方便快速检查整个序列
+static int32_t dec_sheet(img_dec_ctx *ctx)
+{
+    char name[512] = {0};
+    char *separator = NULL;
+    int32_t count = img_dec_get_num(ctx);
+    int32_t cols = sheet_cols;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t ret = 0;
+    uint8_t *data = NULL;
+
+    // 只有管道输入的图片数量未知，偏移量超过文件末尾时图片数量为0
+    if (count < 0)
+    {
+        printf("sheet mode needs a seekable input file\n");
+        return IMG_PARAM_INVALID;
+    }
+    if (count == 0)
+    {
+        if (file_offset_str)
+        {
+            printf("no image in file after offset %s\n", file_offset_str);
+        }
+        else
+        {
+            printf("no image in file\n");
+        }
+        return IMG_OTHER_ERR;
+    }
+    if (cols <= 0)
+    {
+        for (cols = 1; cols * cols < count; cols++);
+    }
+    ret = img_dec_get_sheet_size(ctx, cols, decode_step, &width, &height);
+    if (ret)
+    {
+        printf("get sheet size error, code %d\n", ret);
+        return ret;
+    }
+    if ((int64_t)width * height * 3 > INT32_MAX)
+    {
+        printf("sheet is too large(%d x %d), please use a larger --step\n", width, height);
+        return IMG_PARAM_OVERFLOW;
+    }
+
+    data = (uint8_t *)malloc(width * height * 3);
+    if (data == NULL)
+    {
+        printf("malloc sheet buffer error\n");
+        return IMG_MEM_WRONG;
+    }
+    ret = img_dec_sheet(ctx, data, width * height * 3, cols, decode_step, jobs);
+    if (ret)
+    {
+        printf("dec sheet error, code %d\n", ret);
+    }
+    else
+    {
+        strcpy(name, input_str);
+        separator = strrchr(name, '.');
+        sprintf(separator, "_sheet");
+        change_ext_name(name, "ppm");
+        if (rgb888_dump_ppm(name, data, width, height) == 0)
+        {
+            printf("sheet of %d images finish, save file in %s\n", count, name);
+        }
+    }
+
+    SAFE_FREE(data);
+    return ret;
+}
+
 int main(int argc, const char **argv)
 {
     char tmp_name[512];
@@ -255,7 +544,7 @@ int main(int argc, const char **argv)
 
     if (input_str == NULL ||
         strlen(input_str) > sizeof(tmp_name) - 32 ||
-        strrchr(input_str, '.') == NULL)
+        (strrchr(input_str, '.') == NULL && strcmp(input_str, "-") != 0))
     {
         printf("input file name error(%s)\n", input_str);
         return 1;
@@ -282,6 +571,23 @@ int main(int argc, const char **argv)
         return 1;
     }
 
+    if (dither_str != NULL)
+    {
+        for (i = 0; i < DITHER_INVALID; i++)
+        {
+            if (strcmp(dither_preset[i].dither_str, dither_str) == 0)
+            {
+                break;
+            }
+        }
+        if (i == DITHER_INVALID)
+        {
+            printf("unknown dithering algorithm(%s)\n", dither_str);
+            return 1;
+        }
+        dithering = dither_preset[i].dither;
+    }
+
     if (strcmp(mode_str, "enc") == 0)
     {
         enc_ctx = img_enc_open(input_str);
@@ -302,6 +608,10 @@ int main(int argc, const char **argv)
             .transparence = transparence,
         };
         ret = img_enc_cfg(enc_ctx, &enc_param);
+        if (ret == IMG_OK)
+        {
+            ret = img_enc_set_threads(enc_ctx, jobs);
+        }
         if (ret)
         {
             img_enc_close(enc_ctx);
@@ -356,8 +666,20 @@ int main(int argc, const char **argv)
 
         SAFE_FREE(out_data);
     }
-    else if (strcmp(mode_str, "dec") == 0)
+    else if (strcmp(mode_str, "dec") == 0 || strcmp(mode_str, "sheet") == 0)
     {
+        int64_t file_offset = 0;
+        if (file_offset_str)
+        {
+            char *end = NULL;
+            file_offset = strtoll(file_offset_str, &end, 0);
+            if (end == file_offset_str || *end != '\0' || file_offset < 0)
+            {
+                printf("invalid file offset %s\n", file_offset_str);
+                return 1;
+            }
+        }
+
         dec_ctx = img_dec_open(input_str);
         if (dec_ctx == NULL)
         {
@@ -382,19 +704,61 @@ int main(int argc, const char **argv)
             return 1;
         }
 
+        if (strcmp(mode_str, "sheet") == 0)
+        {
+            ret = dec_sheet(dec_ctx);
+            img_dec_close(dec_ctx);
+            return ret ? 1 : 0;
+        }
+
+        if (roi_str && sscanf(roi_str, "%d,%d,%d,%d", &roi[0], &roi[1], &roi[2], &roi[3]) != 4)
+        {
+            img_dec_close(dec_ctx);
+            printf("invalid decode region %s\n", roi_str);
+            return 1;
+        }
+        ret = img_dec_set_rect(dec_ctx, roi[0], roi[1], roi[2], roi[3], decode_step);
+        if (ret)
+        {
+            img_dec_close(dec_ctx);
+            printf("set dec region error, code %d\n", ret);
+            return 1;
+        }
+        img_dec_get_out_size(dec_ctx, &out_width, &out_height);
+
         int32_t dec_count = img_dec_get_num(dec_ctx);
 
         char name_with_count[512] = {0};
         char *separator = NULL;
-        strcpy(name_with_count, input_str);
+        // 从标准输入读取时保存为 stdin_00000.ppm 等文件
+        strcpy(name_with_count, strcmp(input_str, "-") == 0 ? "stdin.ppm" : input_str);
         separator = strrchr(name_with_count, '.');
 
-        out_size = decode_width * decode_height * 3;
+#ifdef IMG_USE_THREAD
+        // 每个解码线程需要独立打开文件，标准输入只能单线程解码
+        if (jobs > 1 && strcmp(input_str, "-") != 0)
+        {
+            img_dec_close(dec_ctx);
+            return dec_parallel(&dec_param, dec_count, out_width, out_height, name_with_count, separator) ? 1 : 0;
+        }
+#endif
+
+        if (prefetch > 0)
+        {
+            img_dec_prefetch(dec_ctx, prefetch);
+        }
+
+        out_size = out_width * out_height * 3;
         out_data = (uint8_t *)malloc(out_size);
-        for (i = 0; i < dec_count; i++)
+        // 管道的图片数量未知，一直解码到数据结束
+        for (i = 0; dec_count < 0 || i < dec_count; i++)
         {
             img_dec_seek(dec_ctx, SEEK_GOTO, i);
             ret = img_dec(dec_ctx, out_data, out_size);
+            if (ret == IMG_FILE_TAIL && dec_count < 0)
+            {
+                break;
+            }
             if (ret)
             {
                 SAFE_FREE(out_data);
@@ -405,7 +769,7 @@ int main(int argc, const char **argv)
 
             sprintf(separator, "_%05d", i);
             change_ext_name(name_with_count, "ppm");
-            if(rgb888_dump_ppm(name_with_count, out_data, decode_width, decode_height) == 0)
+            if(rgb888_dump_ppm(name_with_count, out_data, out_width, out_height) == 0)
             {
                 printf("dec finish, save file in %s\n", name_with_count);
             }